@@ -0,0 +1,297 @@
+#include "batch.h"
+#include "jobs.h"
+#include "env.h"
+#include "vm.h"
+#include "dag.h"
+#include "input.h"
+#include "helper-routines.h"
+#include "output.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <signal.h>
+
+pid_t spawn(char **argv, char **assign, int nassign, int bg, int quiet, char *cmdline, const int *redir); // defined in tsh.cc
+int spawn_batch(char ***argvs, char **cmdlines, int n, int quiet, pid_t *pids); // defined in tsh.cc
+void waitfg(pid_t pid); // defined in tsh.cc
+void waitevent(const sigset_t *prev); // defined in tsh.cc
+
+/*********************************
+ * Argument batching
+ *********************************/
+
+static char **argv = NULL;      /* the command, then the items so far */
+static int argc = 0, argcap = 0;
+static int ncmd = 0;            /* words of the command itself */
+static long used = 0;           /* bytes of ARG_MAX taken by argv */
+static long base = 0;           /* of which the command takes this much */
+
+static pid_t running[MAXJOBS];  /* batches started in parallel */
+static int nrunning = 0;
+static char **pending[MAXJOBS]; /* and made up, waiting to start */
+static char *plabels[MAXJOBS];
+static int npending = 0;
+static int worst = 0;           /* exit status so far */
+static int stop = 0;            /* a batch was killed or interrupted */
+
+/* cost - What one argument takes of ARG_MAX: the string and its pointer */
+static long cost(const char *s)
+{
+    return strlen(s) + 1 + sizeof(char *);
+}
+
+/* push - Append s (copied if item) to argv */
+static void push(char *s, int item)
+{
+    if (argc + 2 > argcap) {
+	argcap = argcap ? 2 * argcap : 256;
+	if ((argv = (char **)realloc(argv, argcap * sizeof(char *))) == NULL)
+	    unix_error("batch: realloc error");
+    }
+    if (item && (s = strdup(s)) == NULL)
+	unix_error("batch: strdup error");
+    argv[argc++] = s;
+    argv[argc] = NULL;
+    used += cost(s);
+}
+
+/* note - Fold a batch's exit status into the result, as xargs does */
+static void note(int status)
+{
+    if (status == 0)
+	return;
+    if (status >= 128) {
+	stop = 1;
+	worst = 125;
+    }
+    else if (status == 127 || status == 126)
+	worst = worst == 125 ? worst : status;
+    else if (worst == 0)
+	worst = 123;
+}
+
+/*
+ * reap - Note the parallel batches that have finished. With block,
+ *    first sleep on child events until fewer than par are running and
+ *    the job table has room. SIGCHLD must be blocked; prev is the mask
+ *    to sleep with.
+ */
+static void reap(int par, int block, sigset_t *prev)
+{
+    struct done_t *d;
+    int i, j, full;
+
+    for (;;) {
+	for (i = j = 0; i < nrunning; i++) {
+	    if (getjobpid(jobs, running[i]) != NULL) {
+		running[j++] = running[i];
+		continue;
+	    }
+	    if ((d = getdone(running[i])) != NULL) {
+		d->waited = 1;
+		note(d->status);
+	    }
+	}
+	nrunning = j;
+	for (full = 1, i = 0; i < MAXJOBS; i++)
+	    if (jobs[i].pid == 0)
+		full = 0;
+	if (!block || (nrunning < par && !full) || (full && nrunning == 0))
+	    return;
+	if (vm_interrupt) {             /* ctrl-c with no foreground job */
+	    vm_interrupt = 0;
+	    for (i = 0; i < nrunning; i++)
+		kill(-running[i], SIGINT);
+	    stop = 1;
+	}
+	waitevent(prev);
+	dag_run();
+    }
+}
+
+/* room - How many more batches may start now */
+static int room(int par)
+{
+    int i, n = 0;
+
+    for (i = 0; i < MAXJOBS; i++)
+	n += jobs[i].pid == 0;
+    return par - nrunning < n ? par - nrunning : n;
+}
+
+/*
+ * startpending - Start pending batches, all at once through the
+ *    threaded spawner, as soon as there are as many as there is room
+ *    for; until then more may be made up. With all, start every one,
+ *    waiting for room as needed.
+ */
+static void startpending(struct batch_opts *opts, int all)
+{
+    pid_t pids[MAXJOBS];
+    sigset_t mask, prev;
+    int i, j, n;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &prev);
+    while (npending > 0 && !stop) {
+	reap(opts->par, 0, &prev);
+	if ((n = room(opts->par)) <= 0 && nrunning == 0)
+	    n = 1;                      /* the table is full of other jobs: let it fail */
+	if (!all && npending < n)
+	    break;
+	if (n <= 0) {
+	    if (!all && npending < opts->par)
+		break;
+	    reap(opts->par, 1, &prev);
+	    continue;
+	}
+	if (n > npending)
+	    n = npending;
+	spawn_batch(pending, plabels, n, 1, pids);
+	for (i = 0; i < n; i++) {
+	    if (pids[i] == 0)
+		note(126);
+	    else
+		running[nrunning++] = pids[i];
+	    for (j = ncmd; pending[i][j] != NULL; j++)
+		free(pending[i][j]);
+	    free(pending[i]);
+	    free(plabels[i]);
+	}
+	npending -= n;
+	memmove(pending, pending + n, npending * sizeof(pending[0]));
+	memmove(plabels, plabels + n, npending * sizeof(plabels[0]));
+    }
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+}
+
+/*
+ * launch - Run the command with the items gathered so far, or with -P
+ *    make it a pending batch, to be started along with others
+ */
+static void launch(struct batch_opts *opts)
+{
+    char label[MAXLINE];
+    pid_t pid;
+    int i;
+
+    snprintf(label, sizeof(label), "%s (batch of %d)\n", argv[0], argc - ncmd);
+    if (opts->par <= 1) {
+	if ((pid = spawn(argv, NULL, 0, 0, 1, label, NULL)) == 0)
+	    note(126);
+	else {
+	    waitfg(pid);
+	    note(getjobpid(jobs, pid) != NULL ? 128 + SIGTSTP : last_status);
+	}
+	for (i = ncmd; i < argc; i++)
+	    free(argv[i]);
+    }
+    else {
+	if ((pending[npending] = (char **)malloc((argc + 1) * sizeof(char *))) == NULL ||
+	    (plabels[npending] = strdup(label)) == NULL)
+	    unix_error("batch: malloc error");
+	memcpy(pending[npending++], argv, (argc + 1) * sizeof(char *));  /* takes the items */
+	startpending(opts, 0);
+    }
+
+    argc = ncmd;
+    argv[argc] = NULL;
+    used = base;
+}
+
+/* nextline - The next line of items, or NULL at the end */
+static char *nextline(struct batch_opts *opts)
+{
+    static char *line = NULL;
+    static size_t cap = 0;
+
+    if (opts->fp == NULL)
+	return input_getline();
+    return getline(&line, &cap, opts->fp) < 0 ? NULL : line;
+}
+
+/*
+ * batch_run - Run cmd with the items read from opts->fp (or the
+ *    shell's input) appended, in as few commands as fit. Returns 0 if
+ *    every batch succeeded, 123 if one failed, 126 or 127 if one could
+ *    not run, and 125 if one was killed by a signal or ctrl-c stopped
+ *    the run, which then starts no further batches.
+ */
+int batch_run(char **cmd, struct batch_opts *opts)
+{
+    char **envp, *line, *item, *end;
+    long limit = sysconf(_SC_ARG_MAX) - BATCH_HEADROOM;
+    sigset_t mask, prev;
+    int nitems = 0, ncmds = 0;
+
+    for (envp = env_envp(); *envp != NULL; envp++)
+	limit -= cost(*envp);
+    argc = 0;
+    used = sizeof(char *);              /* the NULL at the end */
+    for (ncmd = 0; cmd[ncmd] != NULL; ncmd++)
+	push(cmd[ncmd], 0);
+    base = used;
+    if (used >= limit) {
+	out_printf("batch: environment and command leave no room for items\n");
+	return 1;
+    }
+    worst = stop = nrunning = 0;
+    vm_interrupt = 0;
+
+    while (!stop && (line = nextline(opts)) != NULL) {
+	for (item = line; !stop && item != NULL; item = end) {
+	    if (opts->lines) {              /* the whole line, less its newline */
+		if ((end = strchr(item, '\n')) != NULL)
+		    *end = '\0';
+		end = NULL;
+	    }
+	    else {                          /* the next word */
+		while (isspace((unsigned char)*item))
+		    item++;
+		for (end = item; *end && !isspace((unsigned char)*end); end++)
+		    ;
+		end = *end ? (*end = '\0', end + 1) : NULL;
+	    }
+	    if (*item == '\0')
+		continue;
+	    if (argc > ncmd && (used + cost(item) > limit ||
+				(opts->maxargs > 0 && argc - ncmd == opts->maxargs))) {
+		launch(opts);
+		ncmds++;
+	    }
+	    push(item, 1);
+	    nitems++;
+	}
+    }
+    if (opts->fp == NULL)
+	input_clearerr();               /* ctrl-D at a terminal ended only the items */
+    if (argc > ncmd && !stop) {
+	launch(opts);
+	ncmds++;
+    }
+    startpending(opts, 1);
+    for (int i = ncmd; i < argc; i++)   /* left over after a stop */
+	free(argv[i]);
+    for (; npending > 0; npending--) {
+	for (int i = ncmd; pending[npending - 1][i] != NULL; i++)
+	    free(pending[npending - 1][i]);
+	free(pending[npending - 1]);
+	free(plabels[npending - 1]);
+    }
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &prev);
+    while (nrunning > 0)
+	reap(1, 1, &prev);
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+
+    if (verbose)
+	out_printf("batch: %d items in %d commands\n", nitems, ncmds);
+    return worst;
+}
+/*****************************
+ * end argument batching
+ *****************************/
@@ -0,0 +1,26 @@
+//-*-c++-*-
+#ifndef _batch_h_
+#define _batch_h_
+
+#include <stdio.h>
+
+/*
+ * Argument batching for the batch builtin, in the manner of xargs.
+ * Items are appended to a fixed command and each command line is
+ * packed with as many as the kernel's ARG_MAX allows, less the space
+ * the environment takes, so a long list costs a handful of processes
+ * instead of one per item. Up to par batches run at once.
+ */
+
+#define BATCH_HEADROOM 4096     /* bytes of ARG_MAX left unused */
+
+struct batch_opts {
+    FILE *fp;               /* items from here, or the shell's input if NULL */
+    int lines;              /* one item per line, rather than per word */
+    int maxargs;            /* items per command, 0 for no limit */
+    int par;                /* batches at once */
+};
+
+int batch_run(char **cmd, struct batch_opts *opts);
+
+#endif
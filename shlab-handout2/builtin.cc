@@ -0,0 +1,243 @@
+#include "builtin.h"
+#include "tshbuiltin.h"
+#include "parsecache.h"
+#include "output.h"
+#include <stdio.h>
+#include <string.h>
+#include <dlfcn.h>
+
+/*********************************
+ * The builtin registry
+ *********************************/
+
+struct builtin_t {
+    const char *name;
+    int (*fn)(char **argv);
+    int forks;              /* starts jobs (see builtin_forks) */
+};
+
+/*
+ * The compiled-in builtins. eval() dispatches through the index that
+ * the parsed-command cache resolved for argv[0]. A builtin returns
+ * its exit status.
+ */
+static constexpr struct builtin_t builtins[] = {
+    { "quit",     do_quit,     0 },
+    { "jobs",     do_jobs,     0 },
+    { "fg",       do_bgfg,     0 },
+    { "bg",       do_bgfg,     0 },
+    { "cmdcache", do_cmdcache, 0 },
+    { "true",     do_true,     0 },
+    { "false",    do_false,    0 },
+    { "test",     do_test,     0 },
+    { "[",        do_test,     0 },
+    { "export",   do_export,   0 },
+    { "unset",    do_unset,    0 },
+    { "env",      do_env,      0 },
+    { "wait",     do_wait,     0 },
+    { "timeout",  do_timeout,  1 },
+    { "jtop",     do_jtop,     0 },
+    { "metrics",  do_metrics,  0 },
+    { "after",    do_after,    1 },
+    { "cache",    do_cache,    0 },
+    { "batch",    do_batch,    1 },
+    { "limit",    do_limit,    0 },
+    { "enable",   do_enable,   0 },
+};
+#define NBUILTINS ((int)(sizeof(builtins) / sizeof(builtins[0])))
+
+/* bhash - FNV-1a of name, started from seed */
+static constexpr unsigned bhash(const char *name, unsigned seed)
+{
+    unsigned h = seed;
+
+    while (*name)
+	h = (h ^ (unsigned char)*name++) * 16777619u;
+    return h;
+}
+
+/*
+ * A seed under which every builtin name lands in its own slot, and the
+ * slots filled in. mkphash() runs in the compiler: it tries seeds in
+ * turn until one has no collisions. seed is 0 if none was found.
+ */
+struct phash_t {
+    unsigned seed;
+    signed char slot[BUILTIN_SLOTS];    /* builtin index, -1 if empty */
+};
+
+static constexpr struct phash_t mkphash()
+{
+    struct phash_t p = { 0, {} };
+    unsigned seed = 0;
+    int i = 0, s = 0;
+
+    for (seed = 2166136261u; seed < 2166136261u + 65536; seed++) {
+	for (s = 0; s < BUILTIN_SLOTS; s++)
+	    p.slot[s] = -1;
+	for (i = 0; i < NBUILTINS; i++) {
+	    s = bhash(builtins[i].name, seed) & (BUILTIN_SLOTS - 1);
+	    if (p.slot[s] >= 0)
+		break;
+	    p.slot[s] = i;
+	}
+	if (i == NBUILTINS) {
+	    p.seed = seed;
+	    return p;
+	}
+    }
+    return p;
+}
+
+static constexpr struct phash_t phash = mkphash();
+static_assert(phash.seed != 0, "no perfect hash for the builtin names: raise BUILTIN_SLOTS");
+
+/* Builtins loaded from shared objects, indices NBUILTINS and up */
+static struct tsh_builtin *loaded[BUILTIN_MAXLOAD];
+static int nloaded = 0;
+
+int builtin_gen = 0;
+
+/*
+ * builtin_lookup - Index of name among the builtins, -1 if none
+ */
+int builtin_lookup(const char *name)
+{
+    int i = phash.slot[bhash(name, phash.seed) & (BUILTIN_SLOTS - 1)];
+
+    if (i >= 0 && strcmp(name, builtins[i].name) == 0)
+	return i;
+    for (i = 0; i < nloaded; i++)   /* a handful at most */
+	if (loaded[i] != NULL && strcmp(name, loaded[i]->name) == 0)
+	    return NBUILTINS + i;
+    return -1;
+}
+
+/*
+ * builtin_run - Run builtin i and return its exit status. A loaded
+ *    builtin writes through stdio or straight to the descriptors, so
+ *    our buffered output goes out ahead of it and stdio's after it.
+ */
+int builtin_run(int i, char **argv)
+{
+    struct tsh_builtin *b;
+    int argc, rc;
+
+    if (i < NBUILTINS)
+	return builtins[i].fn(argv);
+    if ((b = loaded[i - NBUILTINS]) == NULL)  /* removed under a cached line */
+	return 127;
+    for (argc = 0; argv[argc] != NULL; argc++)
+	;
+    out_flush();
+    rc = b->fn(argc, argv);
+    fflush(stdout);
+    fflush(stderr);
+    return rc;
+}
+
+/*
+ * builtin_forks - Must $(...) run builtin i in a subshell? One that
+ *    starts jobs must, so that their output goes into the pipe too, and
+ *    so must a loaded one, which writes to fd 1 and not via out_put.
+ */
+int builtin_forks(int i)
+{
+    return i >= NBUILTINS || builtins[i].forks;
+}
+
+/* load - Register builtin name from the shared object path */
+static int load(const char *path, const char *name)
+{
+    char sym[256];
+    struct tsh_builtin *b;
+    void *handle;
+    int i;
+
+    if ((i = builtin_lookup(name)) >= 0 && i < NBUILTINS) {
+	out_printf("enable: %s: is a compiled-in builtin\n", name);
+	return 1;
+    }
+    if ((handle = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+	out_printf("enable: %s\n", dlerror());
+	return 1;
+    }
+    snprintf(sym, sizeof(sym), "%s_builtin", name);
+    if ((b = (struct tsh_builtin *)dlsym(handle, sym)) == NULL) {
+	out_printf("enable: %s: no %s in %s\n", name, sym, path);
+	return 1;
+    }
+    if (b->abi != TSH_BUILTIN_ABI || b->fn == NULL || b->name == NULL ||
+	strcmp(b->name, name) != 0) {
+	out_printf("enable: %s: bad builtin in %s\n", name, path);
+	return 1;
+    }
+
+    if ((i = builtin_lookup(name)) >= 0)       /* reloading replaces it */
+	i -= NBUILTINS;
+    else {
+	for (i = 0; i < nloaded && loaded[i] != NULL; i++)
+	    ;
+	if (i == BUILTIN_MAXLOAD) {
+	    out_printf("enable: %s: too many loaded builtins\n", name);
+	    return 1;
+	}
+	if (i == nloaded)
+	    nloaded++;
+    }
+    loaded[i] = b;
+    builtin_gen++;
+    return 0;
+}
+
+/*
+ * do_enable - enable builtin
+ *
+ *   enable                      list the builtins
+ *   enable -f lib.so name...    load builtins from a shared object
+ *   enable -d name...           remove loaded builtins
+ *
+ * Shared objects stay mapped once loaded; removing a builtin only
+ * takes its name out of the registry.
+ */
+int do_enable(char **argv)
+{
+    int i, rc = 0;
+
+    if (argv[1] == NULL) {
+	for (i = 0; i < NBUILTINS; i++)
+	    out_printf("enable %s\n", builtins[i].name);
+	for (i = 0; i < nloaded; i++)
+	    if (loaded[i] != NULL)
+		out_printf("enable -f %s\t%s\n", loaded[i]->name,
+			   loaded[i]->usage ? loaded[i]->usage : "");
+	return 0;
+    }
+    if (!strcmp(argv[1], "-f")) {
+	if (argv[2] == NULL || argv[3] == NULL) {
+	    out_printf("Usage: enable -f lib.so name...\n");
+	    return 2;
+	}
+	for (i = 3; argv[i] != NULL; i++)
+	    rc |= load(argv[2], argv[i]);
+	return rc;
+    }
+    if (!strcmp(argv[1], "-d")) {
+	for (i = 2; argv[i] != NULL; i++) {
+	    int b = builtin_lookup(argv[i]);
+	    if (b < NBUILTINS) {
+		out_printf("enable: %s: not a loaded builtin\n", argv[i]);
+		rc = 1;
+		continue;
+	    }
+	    loaded[b - NBUILTINS] = NULL;
+	    builtin_gen++;
+	}
+	return rc;
+    }
+    out_printf("Usage: enable [-f lib.so name... | -d name...]\n");
+    return 2;
+}
+/*****************************
+ * end builtin registry
+ *****************************/
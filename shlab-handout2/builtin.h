@@ -0,0 +1,46 @@
+//-*-c++-*-
+#ifndef _builtin_h_
+#define _builtin_h_
+
+/*
+ * The builtin registry. The compiled-in builtins are found through a
+ * perfect hash of their names that the compiler works out from the
+ * table itself, so a lookup is one hash, one probe and one strcmp.
+ * Builtins loaded from shared objects with "enable -f" (see
+ * tshbuiltin.h) follow them in the index space.
+ *
+ * builtin_gen changes whenever a builtin is loaded or removed, so that
+ * cached lookups can tell they are stale.
+ */
+
+#define BUILTIN_SLOTS   64      /* perfect hash table size (power of two) */
+#define BUILTIN_MAXLOAD 32      /* builtins loaded with enable -f */
+
+extern int builtin_gen;
+
+int builtin_lookup(const char *name);
+int builtin_run(int i, char **argv);
+int builtin_forks(int i);
+
+/* The compiled-in builtins, defined in tsh.cc except for enable */
+int do_quit(char **argv);
+int do_jobs(char **argv);
+int do_bgfg(char **argv);
+int do_cmdcache(char **argv);
+int do_true(char **argv);
+int do_false(char **argv);
+int do_test(char **argv);
+int do_export(char **argv);
+int do_unset(char **argv);
+int do_env(char **argv);
+int do_wait(char **argv);
+int do_timeout(char **argv);
+int do_jtop(char **argv);
+int do_metrics(char **argv);
+int do_after(char **argv);
+int do_cache(char **argv);
+int do_batch(char **argv);
+int do_limit(char **argv);
+int do_enable(char **argv);
+
+#endif
@@ -0,0 +1,445 @@
+#include "ctl.h"
+#include "jobs.h"
+#include "parsecache.h"
+#include "timer.h"
+#include "helper-routines.h"
+#include "output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+pid_t spawn(char **argv, char **assign, int nassign, int bg, int quiet, char *cmdline, const int *redir); // defined in tsh.cc
+int do_bgfg(char **argv); // defined in tsh.cc
+
+/**************************************
+ * Helper routines for the control socket
+ **************************************/
+
+struct client_t {
+    int fd;                     /* -1 if the slot is free */
+    char *in;                   /* bytes received, not yet a full request */
+    int inlen, incap;
+    char *out;                  /* reply bytes not yet written */
+    int outlen, outcap;
+};
+
+struct waiter_t {               /* a 'W' request waiting for an exit */
+    int client;                 /* index in clients */
+    pid_t pid;                  /* 0 for -n */
+};
+
+static int listenfd = -1;
+static pid_t owner;             /* the shell, not a forked child */
+static char sockpath[108];
+static struct client_t clients[CTL_MAXCLIENTS];
+static struct waiter_t waiters[CTL_MAXCLIENTS * 4];
+static int nwaiters = 0;
+static int seen_exits = 0;      /* nexits when the waiters were last checked */
+
+/* grow - Make room for n more bytes in a client buffer */
+static void grow(char **buf, int *cap, int need)
+{
+    if (need <= *cap)
+	return;
+    *cap = need > 2 * *cap ? need : 2 * *cap;
+    if ((*buf = (char *)realloc(*buf, *cap)) == NULL)
+	unix_error("ctl: realloc error");
+}
+
+/* reply - Queue a reply frame for client c */
+static void reply(int c, int code, int jid, pid_t pid, const char *text, int textlen)
+{
+    struct client_t *cl = &clients[c];
+    unsigned int hdr[4];
+
+    if (cl->fd < 0)
+	return;
+    hdr[0] = htonl(12 + textlen);
+    hdr[1] = htonl(code);
+    hdr[2] = htonl(jid);
+    hdr[3] = htonl(pid);
+    grow(&cl->out, &cl->outcap, cl->outlen + sizeof(hdr) + textlen);
+    memcpy(cl->out + cl->outlen, hdr, sizeof(hdr));
+    memcpy(cl->out + cl->outlen + sizeof(hdr), text, textlen);
+    cl->outlen += sizeof(hdr) + textlen;
+}
+
+static void fail(int c, const char *msg)
+{
+    reply(c, -1, 0, 0, msg, strlen(msg));
+}
+
+/* dropclient - Close a connection and forget its waits */
+static void dropclient(int c)
+{
+    int i;
+
+    close(clients[c].fd);
+    clients[c].fd = -1;
+    clients[c].inlen = clients[c].outlen = 0;
+    for (i = 0; i < nwaiters; )
+	if (waiters[i].client == c)
+	    waiters[i] = waiters[--nwaiters];
+	else
+	    i++;
+}
+
+/* findjob - Resolve a %jid or pid argument; *pid is set even for finished jobs */
+static struct job_t *findjob(const char *arg, pid_t *pid)
+{
+    struct job_t *job = NULL;
+
+    *pid = 0;
+    if (arg[0] == '%') {
+	if ((job = getjobjid(jobs, atoi(arg + 1))) != NULL)
+	    *pid = job->pid;
+    }
+    else if (isdigit((unsigned char)arg[0])) {
+	*pid = atoi(arg);
+	job = getjobpid(jobs, *pid);
+    }
+    return job;
+}
+
+/* checkwaiters - Answer the waits whose job has ended */
+static void checkwaiters(void)
+{
+    struct done_t *d;
+    int i, running, k;
+
+    seen_exits = nexits;
+    for (i = 0; i < nwaiters; ) {
+	d = NULL;
+	if (waiters[i].pid != 0) {
+	    if (getjobpid(jobs, waiters[i].pid) != NULL) {
+		i++;
+		continue;
+	    }
+	    d = getdone(waiters[i].pid);
+	}
+	else if ((d = nextdone()) == NULL) {
+	    for (running = k = 0; k < MAXJOBS; k++)
+		running += jobs[k].state == BG;
+	    if (running) {
+		i++;
+		continue;
+	    }
+	}
+	if (d != NULL) {
+	    d->waited = 1;
+	    reply(waiters[i].client, d->status, d->jid, d->pid, "", 0);
+	}
+	else
+	    reply(waiters[i].client, 127, 0, waiters[i].pid, "", 0);
+	waiters[i] = waiters[--nwaiters];
+    }
+}
+
+/* request - Carry out one request from client c */
+static void request(int c, char *msg, int len)
+{
+    char op = len > 0 ? msg[0] : 0;
+    char *arg = msg + 1;
+    struct job_t *job;
+    char *argv[3];
+    pid_t pid;
+    int sig, jid;
+
+    msg[len] = '\0';
+    switch (op) {
+    case 'S': {
+	struct pcmd_t *cmd;
+	int n = strlen(arg);
+	char *line = (char *)malloc(n + 2);
+	if (line == NULL)
+	    unix_error("ctl: malloc error");
+	memcpy(line, arg, n);
+	if (n == 0 || line[n-1] != '\n')
+	    line[n++] = '\n';
+	line[n] = '\0';
+	cmd = pc_lookup(line);
+	if (cmd->argv[cmd->nassign] == NULL || cmd->builtin >= 0)
+	    fail(c, "submit: not an external command");
+	else if ((pid = spawn(cmd->argv + cmd->nassign, cmd->argv, cmd->nassign,
+			      1, 1, line, NULL)) == 0)
+	    fail(c, "submit: could not start job");
+	else
+	    reply(c, 0, pid2jid(pid), pid, "", 0);
+	pc_release(cmd);
+	free(line);
+	break;
+    }
+    case 'J': {
+	char *text = NULL;
+	int textlen = 0, cap = 0, i;
+	for (i = 0; i < MAXJOBS; i++) {
+	    if (jobs[i].pid == 0)
+		continue;
+	    grow(&text, &cap, textlen + MAXLINE + 64);
+	    textlen += sprintf(text + textlen, "%d %d %s %s", jobs[i].jid, jobs[i].pid,
+			       jobs[i].state == BG ? "Running" :
+			       jobs[i].state == FG ? "Foreground" : "Stopped",
+			       jobs[i].cmdline);
+	}
+	reply(c, 0, 0, 0, text ? text : "", textlen);
+	free(text);
+	break;
+    }
+    case 'F':
+    case 'B':
+	argv[0] = (char *)(op == 'F' ? "fg" : "bg");
+	argv[1] = arg;
+	argv[2] = NULL;
+	if ((job = findjob(arg, &pid)) == NULL) {
+	    fail(c, "No such job");
+	    break;
+	}
+	if (op == 'F' && fgpid(jobs) != 0) {
+	    fail(c, "fg: a foreground job is running");
+	    break;
+	}
+	jid = job->jid;
+	reply(c, do_bgfg(argv) ? -1 : op == 'F' ? last_status : 0, jid, pid, "", 0);
+	break;
+    case 'K':
+	sig = strtol(arg, &arg, 10);
+	while (*arg == ' ')
+	    arg++;
+	if ((job = findjob(arg, &pid)) == NULL)
+	    fail(c, "No such job");
+	else if (kill(-pid, sig) < 0)
+	    fail(c, strerror(errno));
+	else
+	    reply(c, 0, job->jid, pid, "", 0);
+	break;
+    case 'W':
+	if (nwaiters == (int)(sizeof(waiters) / sizeof(waiters[0]))) {
+	    fail(c, "wait: too many waits");
+	    break;
+	}
+	if (!strcmp(arg, "-n"))
+	    pid = 0;
+	else if (findjob(arg, &pid) == NULL && (pid == 0 || getdone(pid) == NULL)) {
+	    fail(c, "No such job");
+	    break;
+	}
+	waiters[nwaiters].client = c;
+	waiters[nwaiters].pid = pid;
+	nwaiters++;
+	checkwaiters();
+	break;
+    default:
+	fail(c, "unknown request");
+    }
+}
+
+/* readclient - Take in what client c sent and run any complete requests */
+static void readclient(int c)
+{
+    struct client_t *cl = &clients[c];
+    unsigned int len;
+    int n, off;
+
+    for (;;) {
+	grow(&cl->in, &cl->incap, cl->inlen + 4096);
+	if ((n = read(cl->fd, cl->in + cl->inlen, cl->incap - cl->inlen)) <= 0) {
+	    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		break;
+	    dropclient(c);
+	    return;
+	}
+	cl->inlen += n;
+    }
+
+    for (off = 0; cl->inlen - off >= 4; off += 4 + len) {
+	memcpy(&len, cl->in + off, 4);
+	len = ntohl(len);
+	if (len > CTL_MAXMSG) {
+	    dropclient(c);
+	    return;
+	}
+	if (cl->inlen - off < (int)(4 + len))
+	    break;
+	grow(&cl->in, &cl->incap, cl->inlen + 1);   /* room for the terminator */
+	memmove(cl->in + off, cl->in + off + 4, len);   /* request() NUL-terminates */
+	request(c, cl->in + off, len);
+	if (cl->fd < 0)
+	    return;
+    }
+    memmove(cl->in, cl->in + off, cl->inlen - off);
+    cl->inlen -= off;
+}
+
+/* writeclient - Push queued replies out to client c */
+static void writeclient(int c)
+{
+    struct client_t *cl = &clients[c];
+    int n;
+
+    while (cl->outlen > 0) {
+	if ((n = write(cl->fd, cl->out, cl->outlen)) < 0) {
+	    if (errno != EAGAIN && errno != EINTR)
+		dropclient(c);
+	    return;
+	}
+	memmove(cl->out, cl->out + n, cl->outlen - n);
+	cl->outlen -= n;
+    }
+}
+
+/* ctl_open - Listen on the Unix-domain socket at path */
+int ctl_open(const char *path)
+{
+    struct sockaddr_un addr;
+    int i;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+	out_printf("control socket path too long\n");
+	return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if ((listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+	unix_error("ctl: socket error");
+    unlink(path);
+    if (bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	listen(listenfd, 128) < 0)
+	unix_error("ctl: bind error");
+    strcpy(sockpath, path);
+    owner = getpid();
+    for (i = 0; i < CTL_MAXCLIENTS; i++)
+	clients[i].fd = -1;
+    Signal(SIGPIPE, SIG_IGN);           /* a vanished client is just dropped */
+    return 0;
+}
+
+int ctl_active(void)
+{
+    return listenfd >= 0;
+}
+
+/* ctl_pending - Number of requests still waiting for a job to end */
+int ctl_pending(void)
+{
+    return nwaiters;
+}
+
+/* ctl_close - Answer what we can, stop listening and remove the socket file */
+void ctl_close(void)
+{
+    int i;
+
+    if (listenfd < 0 || getpid() != owner)
+	return;
+    if (nwaiters > 0 && nexits != seen_exits)
+	checkwaiters();
+    for (i = 0; i < CTL_MAXCLIENTS; i++)
+	if (clients[i].fd >= 0 && clients[i].outlen > 0)
+	    writeclient(i);
+    ctl_detach();
+    unlink(sockpath);
+}
+
+/* ctl_detach - Close our copies of the socket and connections (a subshell's) */
+void ctl_detach(void)
+{
+    int i;
+
+    if (listenfd < 0)
+	return;
+    for (i = 0; i < CTL_MAXCLIENTS; i++)
+	if (clients[i].fd >= 0)
+	    dropclient(i);
+    close(listenfd);
+    listenfd = -1;
+}
+
+/*
+ * ctl_poll - Serve the control socket until fd is readable (returns 1)
+ *    or timeout_ms passes or a signal arrives (returns 0; a timeout of
+ *    -1 waits forever, and fd may be -1). SIGCHLD is only let in while
+ *    we sleep in ppoll or run requests, so a child event always wakes
+ *    us to check the pending waits, even if the caller has it blocked.
+ *    The caller's signal mask is preserved.
+ */
+int ctl_poll(int fd, int timeout_ms)
+{
+    struct pollfd pfds[CTL_MAXCLIENTS + 2];
+    int map[CTL_MAXCLIENTS + 2];
+    int n, i, fdready = 0, newfd;
+    sigset_t mask, prev, sleepmask;
+    struct timespec ts, *tp = NULL;
+    long long left, end = timeout_ms >= 0 ? timer_now() + timeout_ms * 1000000LL : 0;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &prev);
+    sleepmask = prev;
+    sigdelset(&sleepmask, SIGCHLD);
+    while (!fdready) {
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	if (nwaiters > 0 && nexits != seen_exits)
+	    checkwaiters();
+
+	pfds[0].fd = fd;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = listenfd;
+	pfds[1].events = POLLIN;
+	for (n = 2, i = 0; listenfd >= 0 && i < CTL_MAXCLIENTS; i++) {
+	    if (clients[i].fd < 0)
+		continue;
+	    pfds[n].fd = clients[i].fd;
+	    pfds[n].events = POLLIN | (clients[i].outlen > 0 ? POLLOUT : 0);
+	    map[n++] = i;
+	}
+	if (timeout_ms >= 0) {
+	    left = end - timer_now();
+	    if (left < 0)
+		left = 0;
+	    ts.tv_sec = left / 1000000000;
+	    ts.tv_nsec = left % 1000000000;
+	    tp = &ts;
+	}
+	i = ppoll(pfds, n, tp, &sleepmask);
+	sigprocmask(SIG_SETMASK, &sleepmask, NULL);  /* requests may fork and wait */
+	if (i < 0 && errno != EINTR)
+	    unix_error("ctl: poll error");
+	if (i <= 0)
+	    break;                      /* timed out, or a signal to look at */
+
+	fdready = pfds[0].revents != 0;
+	if (pfds[1].revents & POLLIN) {
+	    while ((newfd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		for (i = 0; i < CTL_MAXCLIENTS && clients[i].fd >= 0; i++)
+		    ;
+		if (i == CTL_MAXCLIENTS)
+		    close(newfd);
+		else
+		    clients[i].fd = newfd;
+	    }
+	}
+	for (i = 2; i < n; i++) {
+	    if (clients[map[i]].fd < 0)
+		continue;
+	    if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR))
+		readclient(map[i]);
+	    if (clients[map[i]].fd >= 0 && clients[map[i]].outlen > 0)
+		writeclient(map[i]);
+	}
+	out_flush();                    /* job messages from socket requests */
+    }
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+    return fdready;
+}
+/*****************************
+ * end control socket
+ *****************************/
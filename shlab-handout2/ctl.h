@@ -0,0 +1,34 @@
+//-*-c++-*-
+#ifndef _ctl_h_
+#define _ctl_h_
+
+/*
+ * The control socket: an optional Unix-domain stream socket through
+ * which programs submit commands and manage jobs.
+ *
+ * Every message, both ways, is a 4-byte big-endian length followed by
+ * that many bytes. A request is an opcode byte plus an argument:
+ *
+ *   'S' cmdline      submit cmdline as a background job
+ *   'J'              list the jobs
+ *   'F' %n|pid       bring a job to the foreground (blocks the shell)
+ *   'B' %n|pid       resume a stopped job in the background
+ *   'K' sig %n|pid   send signal number sig to the job's process group
+ *   'W' %n|pid|-n    reply when the job (or, with -n, any job) ends
+ *
+ * A reply is three big-endian int32s, code (exit status, or -1 for an
+ * error), jid and pid, followed by optional text (the job list or an
+ * error message).
+ */
+
+#define CTL_MAXCLIENTS  64      /* simultaneous connections */
+#define CTL_MAXMSG    65536     /* largest request accepted */
+
+int ctl_open(const char *path);
+int ctl_active(void);
+int ctl_pending(void);
+int ctl_poll(int fd, int timeout_ms);
+void ctl_close(void);
+void ctl_detach(void);
+
+#endif
@@ -0,0 +1,455 @@
+#include "dag.h"
+#include "jobs.h"
+#include "parsecache.h"
+#include "builtin.h"
+#include "expand.h"
+#include "helper-routines.h"
+#include "output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <signal.h>
+
+pid_t spawn(char **argv, char **assign, int nassign, int bg, int quiet, char *cmdline, const int *redir); // defined in tsh.cc
+int spawn_batch(char ***argvs, char **cmdlines, int n, int quiet, pid_t *pids); // defined in tsh.cc
+
+/*******************************************
+ * Helper routines for dependent commands
+ *******************************************/
+
+/* Node states */
+#define WAITING 0   /* prerequisites not all done */
+#define RUNNING 1   /* started as job pid */
+#define DONE    2   /* exited with status 0 */
+#define FAILED  3   /* exited nonzero, or skipped */
+
+struct dep_t {
+    pid_t pid;              /* a job, if node < 0 */
+    int node;               /* index of another command, or -1 */
+    int state;              /* job deps: 0 pending, 1 succeeded, -1 failed */
+};
+
+struct node_t {
+    int id;                 /* @id */
+    char *cmdline;          /* the command, quoted again, with its newline */
+    char *label;            /* name from a DAG file, or NULL */
+    struct dep_t deps[DAG_MAXDEPS];
+    int ndeps;
+    int state;
+    pid_t pid;              /* job once started */
+    int status;             /* exit status once DONE or FAILED */
+};
+
+struct settled_t {              /* a finished command, kept for @id */
+    int id;
+    int status;
+};
+
+static struct node_t *nodes = NULL;
+static int nnodes = 0, capnodes = 0;
+static int nextid = 1;
+static int nactive = 0;         /* WAITING or RUNNING */
+static int cap = 0;             /* running at once; 0 until first use */
+static int dirty = 0;           /* added since the last dag_run */
+static int seen_exits = -1;     /* nexits at the last dag_run */
+static struct settled_t settled[DAG_KEEP];  /* ring of commands freed by dag_run */
+static int settledhead = 0;     /* next ring slot to fill */
+
+/* getcap - The concurrency cap, one per CPU unless set */
+static int getcap(void)
+{
+    if (cap == 0) {
+	cap = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cap < 1)
+	    cap = 1;
+    }
+    return cap;
+}
+
+void dag_setcap(int n)
+{
+    cap = n;
+    dirty = 1;
+}
+
+int dag_pending(void)
+{
+    return nactive;
+}
+
+/* findnode - Index of the command with the given @id, -1 if none */
+static int findnode(int id)
+{
+    int i;
+
+    for (i = 0; i < nnodes; i++)
+	if (nodes[i].id == id)
+	    return i;
+    return -1;
+}
+
+/* getsettled - The freed command with the given @id, NULL if forgotten */
+static struct settled_t *getsettled(int id)
+{
+    int i, k;
+
+    for (i = 1; i <= DAG_KEEP; i++) {
+	k = (settledhead - i + DAG_KEEP) % DAG_KEEP;
+	if (settled[k].id == id)
+	    return &settled[k];
+    }
+    return NULL;
+}
+
+/* joinargs - argv as one command line, quoting words with spaces */
+static char *joinargs(char **argv)
+{
+    int i, n = 2;
+    char *s, *p;
+
+    for (i = 0; argv[i] != NULL; i++)
+	n += strlen(argv[i]) + 3;
+    if ((s = p = (char *)malloc(n)) == NULL)
+	unix_error("after: malloc error");
+    for (i = 0; argv[i] != NULL; i++) {
+	if (i > 0)
+	    *p++ = ' ';
+	if (strchr(argv[i], ' ') != NULL || argv[i][0] == '\0')
+	    p += sprintf(p, "'%s'", argv[i]);
+	else
+	    p += sprintf(p, "%s", argv[i]);
+    }
+    strcpy(p, "\n");
+    return s;
+}
+
+/*
+ * dag_add - Register argv to run once every prerequisite in deps (a
+ *    NULL-terminated list of %jid, pid or @id) has succeeded. Returns
+ *    the new command's @id, or -1 after printing why not.
+ */
+int dag_add(char **deps, char **argv, const char *label)
+{
+    struct node_t *n;
+    struct job_t *job;
+    struct dep_t *d;
+    struct settled_t *s;
+
+    if (argv[0] == NULL) {
+	out_printf("after: missing command\n");
+	return -1;
+    }
+    if (builtin_lookup(argv[0]) >= 0) {
+	out_printf("after: %s: cannot defer a builtin\n", argv[0]);
+	return -1;
+    }
+    if (nnodes == capnodes) {
+	capnodes = capnodes ? 2 * capnodes : 16;
+	if ((nodes = (struct node_t *)realloc(nodes, capnodes * sizeof(struct node_t))) == NULL)
+	    unix_error("after: realloc error");
+    }
+    n = &nodes[nnodes];
+    for (n->ndeps = 0; deps[n->ndeps] != NULL; n->ndeps++) {
+	if (n->ndeps == DAG_MAXDEPS) {
+	    out_printf("after: too many prerequisites\n");
+	    return -1;
+	}
+	d = &n->deps[n->ndeps];
+	d->pid = 0;
+	d->node = -1;
+	d->state = 0;
+	if (deps[n->ndeps][0] == '@') {
+	    if ((d->node = findnode(atoi(deps[n->ndeps] + 1))) >= 0)
+		continue;
+	    if ((s = getsettled(atoi(deps[n->ndeps] + 1))) != NULL) {
+		d->state = s->status == 0 ? 1 : -1;     /* finished: look at how */
+		continue;
+	    }
+	    out_printf("after: %s: No such command\n", deps[n->ndeps]);
+	    return -1;
+	}
+	if (deps[n->ndeps][0] == '%')
+	    job = getjobjid(jobs, atoi(deps[n->ndeps] + 1));
+	else if (isdigit((unsigned char)deps[n->ndeps][0]))
+	    job = getjobpid(jobs, atoi(deps[n->ndeps]));
+	else {
+	    out_printf("after: %s: argument must be a PID, %%jobid or @id\n", deps[n->ndeps]);
+	    return -1;
+	}
+	if (job != NULL)
+	    d->pid = job->pid;
+	else if (isdigit((unsigned char)deps[n->ndeps][0]) && getdone(atoi(deps[n->ndeps])) != NULL)
+	    d->pid = atoi(deps[n->ndeps]);  /* already finished: look at how */
+	else {
+	    out_printf("after: %s: No such job\n", deps[n->ndeps]);
+	    return -1;
+	}
+    }
+
+    n->id = nextid++;
+    n->cmdline = joinargs(argv);
+    n->label = label ? strdup(label) : NULL;
+    n->state = WAITING;
+    n->pid = 0;
+    n->status = 0;
+    nnodes++;
+    nactive++;
+    dirty = 1;
+    return n->id;
+}
+
+/* depstate - 0 while dep is pending, 1 if it succeeded, -1 if it failed */
+static int depstate(struct dep_t *d)
+{
+    struct done_t *done;
+
+    if (d->node >= 0) {
+	switch (nodes[d->node].state) {
+	case DONE:
+	    return 1;
+	case FAILED:
+	    return -1;
+	default:
+	    return 0;
+	}
+    }
+    if (d->state == 0 && getjobpid(jobs, d->pid) == NULL) {
+	done = getdone(d->pid);
+	d->state = done != NULL && done->status == 0 ? 1 : -1;
+    }
+    return d->state;
+}
+
+/* finish - Move node i to DONE or FAILED */
+static void finish(int i, int status)
+{
+    nodes[i].state = status == 0 ? DONE : FAILED;
+    nodes[i].status = status;
+    nactive--;
+}
+
+/* launch - Start node i as a background job */
+static void launch(int i)
+{
+    struct node_t *n = &nodes[i];
+    struct pcmd_t *cmd = pc_lookup(n->cmdline);
+
+    n->pid = spawn(cmd->argv + cmd->nassign, cmd->argv, cmd->nassign, 1, 0, n->cmdline, NULL);
+    pc_release(cmd);
+    if (n->pid == 0)
+	finish(i, 126);
+    else
+	n->state = RUNNING;
+}
+
+/*
+ * startready - Start the n nodes in ready together, through the
+ *    threaded spawner; one with assignments goes alone through spawn(),
+ *    which can give them to just its child.
+ */
+static void startready(int *ready, int n)
+{
+    struct pcmd_t *cmds[MAXJOBS];
+    char **argvs[MAXJOBS], *cmdlines[MAXJOBS];
+    pid_t pids[MAXJOBS];
+    int which[MAXJOBS], i, m = 0;
+
+    for (i = 0; i < n; i++) {
+	cmds[i] = pc_lookup(nodes[ready[i]].cmdline);
+	if (cmds[i]->nassign > 0) {
+	    pc_release(cmds[i]);
+	    cmds[i] = NULL;
+	    launch(ready[i]);
+	    continue;
+	}
+	argvs[m] = cmds[i]->argv;
+	cmdlines[m] = nodes[ready[i]].cmdline;
+	which[m++] = ready[i];
+    }
+    spawn_batch(argvs, cmdlines, m, 0, pids);
+    for (i = 0; i < m; i++) {
+	if ((nodes[which[i]].pid = pids[i]) == 0)
+	    finish(which[i], 126);
+	else
+	    nodes[which[i]].state = RUNNING;
+    }
+    for (i = 0; i < n; i++)
+	if (cmds[i] != NULL)
+	    pc_release(cmds[i]);
+}
+
+/* freeslots - How many more jobs the job table has room for */
+static int freeslots(void)
+{
+    int i, n = 0;
+
+    for (i = 0; i < MAXJOBS; i++)
+	n += jobs[i].pid == 0;
+    return n;
+}
+
+/*
+ * dag_run - Note which commands have finished, skip the ones whose
+ *    prerequisites failed and start the ready ones, up to the cap.
+ *    Prerequisites always have lower indices, so one pass in order
+ *    settles everything. The caller's signal mask is preserved.
+ */
+void dag_run(void)
+{
+    struct done_t *done;
+    sigset_t mask;
+    int ready[MAXJOBS];
+    int i, j, s, running = 0, nready = 0, room, status;
+
+    if (nactive == 0 || (!dirty && nexits == seen_exits))
+	return;
+    dirty = 0;
+    seen_exits = nexits;
+
+    for (i = 0; i < nnodes; i++)
+	if (nodes[i].state == RUNNING && getjobpid(jobs, nodes[i].pid) == NULL) {
+	    done = getdone(nodes[i].pid);
+	    finish(i, done != NULL ? done->status : 127);
+	}
+	else if (nodes[i].state == RUNNING)
+	    running++;
+
+    room = freeslots();
+    for (i = 0; i < nnodes; i++) {
+	if (nodes[i].state != WAITING)
+	    continue;
+	for (s = 1, j = 0; j < nodes[i].ndeps && s >= 0; j++)
+	    if ((s = depstate(&nodes[i].deps[j])) == 0)
+		break;
+	if (s < 0) {
+	    out_printf("[@%d] Skipped %s", nodes[i].id, nodes[i].cmdline);
+	    finish(i, 1);
+	}
+	else if (s > 0 && running < getcap() && nready < room) {
+	    ready[nready++] = i;        /* all started together below */
+	    running++;
+	}
+    }
+    if (nready > 0) {
+	status = last_status;           /* launching sets $?, but these are not the user's */
+	sigprocmask(SIG_BLOCK, NULL, &mask);
+	startready(ready, nready);
+	sigprocmask(SIG_SETMASK, &mask, NULL);  /* spawn() unblocks SIGCHLD */
+	last_status = status;
+    }
+
+    if (nactive == 0) {             /* all settled: start over, keeping how they ended */
+	for (i = 0; i < nnodes; i++) {
+	    settled[settledhead].id = nodes[i].id;
+	    settled[settledhead].status = nodes[i].status;
+	    settledhead = (settledhead + 1) % DAG_KEEP;
+	    free(nodes[i].cmdline);
+	    free(nodes[i].label);
+	}
+	nnodes = 0;
+    }
+}
+
+/* dag_detach - Drop the commands, which are the shell's to run (a subshell's) */
+void dag_detach(void)
+{
+    nnodes = nactive = 0;
+}
+
+/* dag_list - Print the registered commands that have not finished */
+void dag_list(void)
+{
+    int i;
+
+    for (i = 0; i < nnodes; i++)
+	if (nodes[i].state == WAITING || nodes[i].state == RUNNING)
+	    out_printf("[@%d] %s%s%s %s", nodes[i].id,
+		       nodes[i].state == WAITING ? "Waiting" : "Running",
+		       nodes[i].label ? " " : "", nodes[i].label ? nodes[i].label : "",
+		       nodes[i].cmdline);
+}
+
+/*
+ * dag_load - Register every command in a DAG file. Each line is
+ *
+ *     name: [prerequisite ...] -- command [args]
+ *
+ *    where a prerequisite is the name of an earlier line, %jid, pid
+ *    or @id. Blank lines and lines starting with # are ignored.
+ *    Returns 0, or -1 (registering nothing more) at the first bad line.
+ */
+int dag_load(const char *path)
+{
+    FILE *fp;
+    struct pcmd_t *cmd;
+    char *line = NULL, *expanded = NULL, idbuf[DAG_MAXDEPS][16];
+    char **argv, *deps[DAG_MAXDEPS + 1], *name, *s;
+    size_t cap = 0;
+    int lineno = 0, xcap = 0, rc = 0, i, j, k, len;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+	out_printf("after: %s: cannot open\n", path);
+	return -1;
+    }
+    while (rc == 0 && (len = getline(&line, &cap, fp)) >= 0) {
+	lineno++;
+	if (len == 0 || line[len - 1] != '\n') {
+	    if ((line = (char *)realloc(line, len + 2)) == NULL)
+		unix_error("after: realloc error");
+	    cap = len + 2;
+	    strcpy(line + len, "\n");
+	}
+	for (s = line; *s == ' ' || *s == '\t'; s++)
+	    ;
+	if (*s == '#' || *s == '\n')
+	    continue;
+	cmd = pc_lookup(expand_alloc(s, &expanded, &xcap));
+	argv = cmd->argv;
+
+	name = argv[0];
+	len = name ? strlen(name) : 0;
+	if (len < 2 || name[len - 1] != ':') {
+	    out_printf("after: %s:%d: expected name:\n", path, lineno);
+	    rc = -1;
+	}
+	for (i = 1, k = 0; rc == 0 && argv[i] != NULL && strcmp(argv[i], "--") != 0; i++, k++) {
+	    if (k == DAG_MAXDEPS) {
+		out_printf("after: %s:%d: too many prerequisites\n", path, lineno);
+		rc = -1;
+		break;
+	    }
+	    deps[k] = argv[i];
+	    if (argv[i][0] == '%' || argv[i][0] == '@' || isdigit((unsigned char)argv[i][0]))
+		continue;
+	    for (j = nnodes - 1; j >= 0; j--)   /* an earlier line's name */
+		if (nodes[j].label != NULL && !strcmp(nodes[j].label, argv[i]))
+		    break;
+	    if (j < 0) {
+		out_printf("after: %s:%d: %s: No such command\n", path, lineno, argv[i]);
+		rc = -1;
+		break;
+	    }
+	    sprintf(idbuf[k], "@%d", nodes[j].id);
+	    deps[k] = idbuf[k];
+	}
+	if (rc == 0) {
+	    deps[k] = NULL;
+	    name[len - 1] = '\0';          /* the entry is ours while pinned */
+	    if (argv[i] == NULL)
+		out_printf("after: %s:%d: expected -- command\n", path, lineno);
+	    if (argv[i] == NULL || dag_add(deps, argv + i + 1, name) < 0)
+		rc = -1;
+	    name[len - 1] = ':';
+	}
+	pc_release(cmd);
+    }
+    free(line);
+    free(expanded);
+    fclose(fp);
+    return rc;
+}
+/*****************************
+ * end dependent commands
+ *****************************/
@@ -0,0 +1,28 @@
+//-*-c++-*-
+#ifndef _dag_h_
+#define _dag_h_
+
+/*
+ * Dependent commands for the after builtin. A command registered with
+ * after waits for its prerequisites (jobs, or other registered
+ * commands named @id) and is started as a background job once they
+ * have all exited with status 0. If one fails, the command is skipped
+ * and counts as failed for whatever depends on it in turn.
+ *
+ * dag_run() does the bookkeeping; the shell calls it whenever it wakes
+ * up (a child event, the next input line), so it costs no extra
+ * processes. At most dag_setcap() commands run at a time.
+ */
+
+#define DAG_MAXDEPS 16      /* prerequisites per command */
+#define DAG_KEEP   256      /* finished commands remembered for @id */
+
+int dag_add(char **deps, char **argv, const char *label);
+int dag_load(const char *path);
+void dag_run(void);
+void dag_detach(void);
+int dag_pending(void);
+void dag_setcap(int cap);
+void dag_list(void);
+
+#endif
@@ -0,0 +1,243 @@
+#include "env.h"
+#include "helper-routines.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/**********************************************
+ * Helper routines for the environment store
+ **********************************************/
+
+/*
+ * A table of "NAME=value" strings, hashed by name. The exported one's
+ * vars array is the envp children get; shell variables that are not
+ * exported live in a second table of the same kind.
+ */
+struct store_t {
+    char **vars;                /* "NAME=value" strings, NULL terminated */
+    int *chain;                 /* next slot in the same bucket, -1 at the end */
+    int nvars, capvars;
+    int buckets[ENV_BUCKETS];
+};
+
+static struct store_t exported, local;
+
+/* namelen - Length of the NAME part of "NAME=value" (or of a bare name) */
+static int namelen(const char *s)
+{
+    const char *eq = strchr(s, '=');
+
+    return eq ? eq - s : strlen(s);
+}
+
+/* hashname - FNV-1a over the n bytes of a name */
+static unsigned hashname(const char *s, int n)
+{
+    unsigned h = 2166136261u;
+    int i;
+
+    for (i = 0; i < n; i++) {
+	h ^= (unsigned char)s[i];
+	h *= 16777619u;
+    }
+    return h & (ENV_BUCKETS-1);
+}
+
+/* find - Slot of t holding the n-byte name s, -1 if unset */
+static int find(struct store_t *t, const char *s, int n)
+{
+    int i;
+
+    if (t->vars == NULL)
+	return -1;
+    for (i = t->buckets[hashname(s, n)]; i >= 0; i = t->chain[i])
+	if (strncmp(t->vars[i], s, n) == 0 && t->vars[i][n] == '=')
+	    return i;
+    return -1;
+}
+
+/* unchain - Take slot i of t out of its hash chain */
+static void unchain(struct store_t *t, int i)
+{
+    int *p = &t->buckets[hashname(t->vars[i], namelen(t->vars[i]))];
+
+    while (*p != i)
+	p = &t->chain[*p];
+    *p = t->chain[i];
+}
+
+/* store - Put str in t's slot for its name, appending a slot if needed */
+static int store(struct store_t *t, char *str)
+{
+    int n = namelen(str), i;
+
+    if ((i = find(t, str, n)) >= 0) {
+	t->vars[i] = str;
+	return i;
+    }
+    if (t->nvars + 1 >= t->capvars) {
+	t->capvars = t->capvars ? 2 * t->capvars : 64;
+	t->vars = (char **)realloc(t->vars, t->capvars * sizeof(char *));
+	t->chain = (int *)realloc(t->chain, t->capvars * sizeof(int));
+	if (t->vars == NULL || t->chain == NULL)
+	    unix_error("env: realloc error");
+    }
+    i = t->nvars++;
+    t->vars[i] = str;
+    t->vars[t->nvars] = NULL;
+    t->chain[i] = t->buckets[hashname(str, n)];
+    t->buckets[hashname(str, n)] = i;
+    return i;
+}
+
+/* replace - Store str (ours to free) in t, freeing the string it replaces */
+static void replace(struct store_t *t, char *str)
+{
+    char *old = NULL;
+    int i;
+
+    if ((i = find(t, str, namelen(str))) >= 0)
+	old = t->vars[i];
+    store(t, str);
+    free(old);
+}
+
+/* drop - Remove the n-byte name from t, moving the last slot into its place */
+static int drop(struct store_t *t, const char *name, int n)
+{
+    int i, last;
+
+    if ((i = find(t, name, n)) < 0)
+	return 0;
+    unchain(t, i);
+    free(t->vars[i]);
+    last = --t->nvars;
+    if (i != last) {
+	unchain(t, last);
+	t->vars[i] = t->vars[last];
+	t->chain[i] = t->buckets[hashname(t->vars[i], namelen(t->vars[i]))];
+	t->buckets[hashname(t->vars[i], namelen(t->vars[i]))] = i;
+    }
+    t->vars[t->nvars] = NULL;
+    return 1;
+}
+
+/* owner - The table name belongs in: exported if it already is there */
+static struct store_t *owner(const char *name, int n)
+{
+    return find(&exported, name, n) >= 0 ? &exported : &local;
+}
+
+/* env_init - Load the store from the environment the shell started with */
+void env_init(char **envp)
+{
+    int i;
+
+    for (i = 0; i < ENV_BUCKETS; i++)
+	exported.buckets[i] = local.buckets[i] = -1;
+    exported.nvars = local.nvars = 0;
+    for (; envp && *envp; envp++)
+	if (strchr(*envp, '=') != NULL)
+	    env_export(*envp);
+}
+
+/* env_envp - The live envp array of the exported variables, ready for execve */
+char **env_envp(void)
+{
+    static char *empty[1] = { NULL };
+
+    return exported.vars ? exported.vars : empty;
+}
+
+/* env_get - Value of name, exported or not, NULL if unset */
+const char *env_get(const char *name)
+{
+    int n = strlen(name), i;
+    struct store_t *t = owner(name, n);
+
+    if ((i = find(t, name, n)) < 0)
+	return NULL;
+    return t->vars[i] + n + 1;
+}
+
+/* env_put - Set a variable from a "NAME=value" string (copied); exported only if it was */
+void env_put(const char *str)
+{
+    char *copy;
+
+    if ((copy = strdup(str)) == NULL)
+	unix_error("env: strdup error");
+    replace(owner(str, namelen(str)), copy);
+}
+
+/* env_set - Set name to value; exported only if it was */
+void env_set(const char *name, const char *value)
+{
+    int n = strlen(name), m = strlen(value);
+    char *str;
+
+    if ((str = (char *)malloc(n + m + 2)) == NULL)
+	unix_error("env: malloc error");
+    memcpy(str, name, n);
+    str[n] = '=';
+    memcpy(str + n + 1, value, m + 1);
+    replace(owner(name, n), str);
+}
+
+/*
+ * env_export - Export "NAME=value", or a bare NAME with the value it
+ *    has (empty if unset), so that children get it from now on
+ */
+void env_export(const char *str)
+{
+    int n = namelen(str), i;
+    char *copy;
+
+    if (str[n] == '=')
+	copy = strdup(str);
+    else if ((i = find(&local, str, n)) >= 0)
+	copy = strdup(local.vars[i]);
+    else if (find(&exported, str, n) >= 0)
+	return;
+    else if ((copy = (char *)malloc(n + 2)) != NULL) {
+	memcpy(copy, str, n);
+	strcpy(copy + n, "=");
+    }
+    if (copy == NULL)
+	unix_error("env: strdup error");
+    drop(&local, str, n);
+    replace(&exported, copy);
+}
+
+/*
+ * env_override - Layer a "NAME=value" string over the environment
+ *    without copying it. Only for a forked child about to exec: the
+ *    string is borrowed and the old value is not freed.
+ */
+void env_override(char *str)
+{
+    store(&exported, str);
+}
+
+/* env_unset - Remove name, exported or not */
+int env_unset(const char *name)
+{
+    int n = strlen(name);
+
+    return drop(&exported, name, n) | drop(&local, name, n);
+}
+
+/* env_assignment - Is word of the form NAME=value? */
+int env_assignment(const char *word)
+{
+    const char *s = word;
+
+    if (!isalpha((unsigned char)*s) && *s != '_')
+	return 0;
+    while (isalnum((unsigned char)*s) || *s == '_')
+	s++;
+    return *s == '=';
+}
+/*****************************
+ * end environment store
+ *****************************/
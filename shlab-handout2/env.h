@@ -0,0 +1,25 @@
+//-*-c++-*-
+#ifndef _env_h_
+#define _env_h_
+
+/*
+ * The environment store. Variables live as "NAME=value" strings in
+ * an envp array that is kept ready for execve: set and unset patch
+ * one slot, so launching a command never rebuilds the environment.
+ * Shell variables that were never exported are kept apart, out of
+ * the envp, but read and set the same way.
+ */
+
+#define ENV_BUCKETS 256   /* hash buckets (power of two) */
+
+void env_init(char **envp);
+char **env_envp(void);
+const char *env_get(const char *name);
+void env_set(const char *name, const char *value);
+void env_put(const char *str);
+void env_export(const char *str);
+void env_override(char *str);
+int env_unset(const char *name);
+int env_assignment(const char *word);
+
+#endif
@@ -0,0 +1,175 @@
+#include "expand.h"
+#include "env.h"
+#include "globals.h"
+#include "helper-routines.h"
+#include "output.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+
+int capture(const char *cmd, struct outcap *c); // defined in tsh.cc
+
+/***********************************
+ * Variable expansion and command substitution of command lines
+ ***********************************/
+
+struct xbuf {
+    char *s;                /* output so far */
+    int len, size;          /* size is fixed unless grow */
+    int grow;               /* realloc s as needed, else truncate */
+};
+
+/* isname - Can c appear in a variable name? */
+static int isname(int c)
+{
+    return isalnum(c) || c == '_';
+}
+
+/* put - Append n bytes of s to o, growing it or dropping what does not fit */
+static void put(struct xbuf *o, const char *s, int n)
+{
+    if (o->len + n + 1 > o->size) {
+	if (o->grow) {
+	    o->size = o->len + n + 1 > 2 * o->size ? o->len + n + 1 : 2 * o->size;
+	    if ((o->s = (char *)realloc(o->s, o->size)) == NULL)
+		unix_error("expand: realloc error");
+	}
+	else if ((n = o->size - 1 - o->len) <= 0)
+	    return;
+    }
+    memcpy(o->s + o->len, s, n);
+    o->len += n;
+}
+
+/* closing - End of the $( at p (just past the paren), NULL if unterminated */
+static const char *closing(const char *p)
+{
+    int depth = 1, quoted = 0;
+
+    for (; *p; p++) {
+	if (*p == '\'')
+	    quoted = !quoted;
+	else if (!quoted && *p == '(')
+	    depth++;
+	else if (!quoted && *p == ')' && --depth == 0)
+	    return p;
+    }
+    return NULL;
+}
+
+/*
+ * subst - Run the n-byte command at cmd and append its output to o.
+ *    Trailing newlines go, and the rest is split into words right in
+ *    the capture buffer: each run of blanks and newlines becomes one
+ *    space, the separator parseline() knows.
+ */
+static void subst(struct xbuf *o, const char *cmd, int n)
+{
+    struct outcap c = { NULL, 0, 0, NULL };
+    char *line, *r, *w;
+
+    if ((line = (char *)malloc(n + 2)) == NULL)
+	unix_error("expand: malloc error");
+    memcpy(line, cmd, n);
+    strcpy(line + n, "\n");
+    capture(line, &c);
+    free(line);
+
+    for (r = w = c.buf; r < c.buf + c.len; r++) {
+	if (*r != ' ' && *r != '\t' && *r != '\n')
+	    *w++ = *r;
+	else if (w > c.buf && w[-1] != ' ')
+	    *w++ = ' ';
+    }
+    if (w > c.buf && w[-1] == ' ')
+	w--;
+    put(o, c.buf, w - c.buf);
+    free(c.buf);
+}
+
+/* expand - Expand in into o */
+static void expand(const char *in, struct xbuf *o)
+{
+    char name[256];
+    const char *p, *val, *end;
+    int quoted = 0, n;
+
+    for (p = in; *p; ) {
+	if (*p == '\'')
+	    quoted = !quoted;
+	if (quoted || (*p != '$' && *p != '`')) {
+	    put(o, p++, 1);
+	    continue;
+	}
+
+	/* $(command) or `command` */
+	if ((p[0] == '`' && (end = strchr(p + 1, '`')) != NULL) ||
+	    (p[0] == '$' && p[1] == '(' && (end = closing(p + 2)) != NULL)) {
+	    val = p + (*p == '`' ? 1 : 2);
+	    subst(o, val, end - val);
+	    p = end + 1;
+	    continue;
+	}
+
+	/* $?, the last command's exit status */
+	if (p[0] == '$' && p[1] == '?') {
+	    n = snprintf(name, sizeof(name), "%d", last_status);
+	    put(o, name, n);
+	    p += 2;
+	    continue;
+	}
+
+	/* $NAME or ${NAME} */
+	if (p[0] == '$' && p[1] == '{' && (val = strchr(p + 2, '}')) != NULL) {
+	    n = val - (p + 2);
+	    p = val + 1;
+	    val = p - n - 1;
+	}
+	else if (p[0] == '$' && isname((unsigned char)p[1])) {
+	    for (n = 1; isname((unsigned char)p[n]); n++)
+		;
+	    val = p + 1;
+	    p += n;
+	    n--;
+	}
+	else {
+	    put(o, p++, 1);
+	    continue;
+	}
+	if (n >= (int)sizeof(name))
+	    n = sizeof(name) - 1;
+	memcpy(name, val, n);
+	name[n] = '\0';
+	if ((val = env_get(name)) != NULL)
+	    put(o, val, strlen(val));
+    }
+    o->s[o->len] = '\0';
+}
+
+char *expand_line(char *in, char *out, int size)
+{
+    struct xbuf o = { out, 0, size, 0 };
+
+    if (strpbrk(in, "$`") == NULL)
+	return in;
+    expand(in, &o);
+    return out;
+}
+
+char *expand_alloc(char *in, char **out, int *cap)
+{
+    struct xbuf o = { *out, 0, *cap, 1 };
+
+    if (strpbrk(in, "$`") == NULL)
+	return in;
+    if (o.size == 0)
+	put(&o, "", 0);
+    expand(in, &o);
+    *out = o.s;
+    *cap = o.size;
+    return *out;
+}
+/*****************************
+ * end variable expansion
+ *****************************/
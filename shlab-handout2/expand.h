@@ -0,0 +1,21 @@
+//-*-c++-*-
+#ifndef _expand_h_
+#define _expand_h_
+
+#define SUBST_PIPESZ (1 << 20)  /* pipe size asked for by $(command) */
+
+/*
+ * expand_line - Substitute $NAME, ${NAME}, $?, $(command) and
+ *    `command` in a command line. A substitution is replaced by the command's
+ *    output split into words. Text inside single quotes is left alone. Returns in itself when
+ *    there is nothing to expand, otherwise out (size bytes, truncated).
+ */
+char *expand_line(char *in, char *out, int size);
+
+/*
+ * expand_alloc - The same without a length limit: out is a malloc'd
+ *    buffer of *cap bytes (NULL and 0 to start) that grows as needed.
+ */
+char *expand_alloc(char *in, char **out, int *cap);
+
+#endif
@@ -3,13 +3,16 @@
 #define _global_h_
 
 /* Misc manifest constants */
-#define MAXLINE    1024   /* max line size */
-#define MAXARGS     128   /* max args on a command line */
+#define MAXLINE    1024   /* line buffer size; eval takes longer ones */
+#define MAXARGS (MAXLINE/2 + 1) /* max args in a MAXLINE line */
 #define MAXJOBS      16   /* max jobs at any point in time */
 #define MAXJID    1<<16   /* max job ID */
+#define MAXDONE      64   /* exit statuses remembered for wait */
+#define GRACE_MS   2000   /* quit: SIGTERM to SIGKILL, in ms */
 
 /* Global variables */
 extern int verbose;   // defined in tcsh.cc
+extern int last_status;   // exit status of the last command, defined in tsh.cc
 //extern char sbuf[MAXLINE];         /* for composing sprintf messages */
 /* End global variables */
 
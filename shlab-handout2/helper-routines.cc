@@ -1,5 +1,7 @@
 #include "helper-routines.h"
 #include "globals.h"
+#include "output.h"
+#include "record.h"
 #include <stdio.h>
 #include <strings.h>
 #include <memory.h> // strcpy and memcpy
@@ -7,6 +9,8 @@
 #include <stdlib.h>
 #include <errno.h>
 
+void teardown(void); // defined in tsh.cc
+
 /***********************
  * Other helper routines
  ***********************/
@@ -16,10 +20,16 @@
  */
 void usage(void) 
 {
-    printf("Usage: shell [-hvp]\n");
-    printf("   -h   print this message\n");
-    printf("   -v   print additional diagnostic information\n");
-    printf("   -p   do not emit a command prompt\n");
+    out_printf("Usage: shell [-hvpjr] [-S socket] [-M file] [-R file] [-c command]\n");
+    out_printf("   -h   print this message\n");
+    out_printf("   -v   print additional diagnostic information\n");
+    out_printf("   -p   do not emit a command prompt\n");
+    out_printf("   -j   publish the job table in shared memory for tshstat\n");
+    out_printf("   -r   reap orphaned descendants of jobs, which end with their group\n");
+    out_printf("   -S   accept commands on a Unix-domain control socket\n");
+    out_printf("   -M   write metrics to file for the node_exporter textfile collector\n");
+    out_printf("   -R   record the session to file for replay.pl\n");
+    out_printf("   -c   run command and exit with its status\n");
     exit(1);
 }
 
@@ -28,7 +38,7 @@ void usage(void)
  */
 void unix_error(const char *msg)
 {
-    fprintf(stdout, "%s: %s\n", msg, strerror(errno));
+    out_printf("%s: %s\n", msg, strerror(errno));
     exit(1);
 }
 
@@ -37,7 +47,7 @@ void unix_error(const char *msg)
  */
 void app_error(const char *msg)
 {
-    fprintf(stdout, "%s\n", msg);
+    out_printf("%s\n", msg);
     exit(1);
 }
 
@@ -63,7 +73,10 @@ handler_t *Signal(int signum, handler_t *handler)
  */
 void sigquit_handler(int sig) 
 {
-    printf("Terminating after receipt of SIGQUIT signal\n");
+    rec_signal(sig);
+    out_inhandler++;
+    out_safef("Terminating after receipt of SIGQUIT signal\n");
+    teardown();
     exit(1);
 }
 
@@ -72,11 +85,12 @@ void sigquit_handler(int sig)
  * 
  * Characters enclosed in single quotes are treated as a single
  * argument.  Return true if the user has requested a BG job, false if
- * the user has requested a FG job.  
+ * the user has requested a FG job.  The arguments point into array,
+ * which must hold strlen(cmdline)+1 characters and outlive argv; argv
+ * needs room for strlen(cmdline)/2 + 1 pointers.
  */
-int parseline(const char *cmdline, char **argv) 
+int parseline(const char *cmdline, char *array, char **argv) 
 {
-    char array[MAXLINE]; /* holds local copy of command line */
     char *buf = array;          /* ptr that traverses command line */
     char *delim;                /* points to first space delimiter */
     int argc;                   /* number of args */
@@ -7,7 +7,7 @@
 #include <sys/wait.h>
 
 /* Here are helper routines that we've provided for you */
-int parseline(const char *cmdline, char **argv); 
+int parseline(const char *cmdline, char *array, char **argv); 
 void sigquit_handler(int sig);
 void usage(void);
 void unix_error(const char *msg);
@@ -0,0 +1,140 @@
+#include "input.h"
+#include "ctl.h"
+#include "metrics.h"
+#include "dag.h"
+#include "parsecache.h"
+#include "vm.h"
+#include "globals.h"
+#include "helper-routines.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+/*****************************
+ * Command input line reader
+ *****************************/
+
+static char inbuf[8192];        /* bytes read but not yet returned */
+static int inpos = 0, inlen = 0;
+static int ineof = 0;
+static int seekable = -1;       /* stdin is a regular file; -1 until checked */
+
+/*
+ * input_getline - Read the next line, newline included, however long
+ *    it is. The line is in a buffer of ours, good until the next call.
+ *    Returns NULL at end of input; a last line without a newline is
+ *    dropped, as the fgets loop did.
+ */
+char *input_getline(void)
+{
+    static char *line = NULL;
+    static int cap = 0;
+    char *nl;
+    int n, len = 0;
+
+    for (;;) {
+	nl = (char *)memchr(inbuf + inpos, '\n', inlen - inpos);
+	n = nl ? nl - (inbuf + inpos) + 1 : inlen - inpos;
+	if (len + n + 1 > cap) {
+	    cap = len + n + 1 > 2 * cap ? len + n + 1 : 2 * cap;
+	    if ((line = (char *)realloc(line, cap)) == NULL)
+		unix_error("input: realloc error");
+	}
+	memcpy(line + len, inbuf + inpos, n);  /* all of it, or what we have */
+	len += n;
+	inpos += n;
+	if (nl != NULL) {
+	    line[len] = '\0';
+	    return line;
+	}
+	if (ineof)
+	    return NULL;
+
+	inpos = inlen = 0;
+	while (ctl_active() || metrics_due() >= 0 || dag_pending()) {
+	    metrics_tick();
+	    dag_run();
+	    if (ctl_poll(STDIN_FILENO, metrics_due()))
+		break;                  /* served the socket until stdin was ready */
+	}
+	if ((n = read(STDIN_FILENO, inbuf, sizeof(inbuf))) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    unix_error("read error");
+	}
+	if (n == 0)
+	    ineof = 1;
+	inlen = n;
+    }
+}
+/*
+ * input_clearerr - Forget that input ended, if it comes from a
+ *    terminal: there ctrl-D only ends what was reading (batch), and
+ *    the shell reads on after it.
+ */
+void input_clearerr(void)
+{
+    if (isatty(STDIN_FILENO))
+	ineof = 0;
+}
+
+/*
+ * prefetch - Parse the len-byte line at s into the parsed-command
+ *    cache, just as eval() will look it up. Lines the VM takes, and
+ *    lines with variables (whose expansion may change by then), are
+ *    left alone.
+ */
+static void prefetch(const char *s, int len)
+{
+    char line[MAXLINE];
+
+    if (len >= MAXLINE || memchr(s, '$', len) != NULL || memchr(s, '`', len) != NULL)
+	return;
+    memcpy(line, s, len);
+    line[len] = '\0';
+    if (!vm_iscontrol(line))
+	pc_prefetch(line);
+}
+
+/*
+ * input_readahead - Parse up to n of the lines after the current one
+ *    while a foreground job runs, so they are cache hits when their
+ *    turn comes. Lines already in our buffer cost no I/O; when stdin
+ *    is a regular file, more is fetched with pread, which leaves the
+ *    file offset the child shares alone. A pipe or terminal is never
+ *    read here, since its next bytes may be meant for the child.
+ */
+void input_readahead(int n)
+{
+    char ahead[sizeof(inbuf)];
+    char *p = inbuf + inpos, *end = inbuf + inlen, *nl;
+    struct stat sb;
+    off_t off;
+    int len, k;
+
+    for (; n > 0 && (nl = (char *)memchr(p, '\n', end - p)) != NULL; n--) {
+	prefetch(p, nl - p + 1);
+	p = nl + 1;
+    }
+    if (n == 0 || ineof)
+	return;
+
+    if (seekable < 0)
+	seekable = fstat(STDIN_FILENO, &sb) == 0 && S_ISREG(sb.st_mode);
+    if (!seekable || (off = lseek(STDIN_FILENO, 0, SEEK_CUR)) < 0)
+	return;
+    len = end - p;                      /* the partial line we hold */
+    memcpy(ahead, p, len);
+    if ((k = pread(STDIN_FILENO, ahead + len, sizeof(ahead) - len, off)) <= 0)
+	return;
+    end = ahead + len + k;
+    for (p = ahead; n > 0 && (nl = (char *)memchr(p, '\n', end - p)) != NULL; n--) {
+	prefetch(p, nl - p + 1);
+	p = nl + 1;
+    }
+}
+/*****************************
+ * end command input
+ *****************************/
@@ -0,0 +1,17 @@
+//-*-c++-*-
+#ifndef _input_h_
+#define _input_h_
+
+/*
+ * The shell's command input. Lines are read from fd 0 through our
+ * own buffer rather than stdio, so the read loop can wait on stdin
+ * and the control socket together.
+ */
+
+#define READAHEAD 8     /* lines pre-parsed while a foreground job runs */
+
+char *input_getline(void);
+void input_clearerr(void);
+void input_readahead(int n);
+
+#endif
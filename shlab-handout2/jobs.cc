@@ -1,7 +1,11 @@
 #include "jobs.h"
+#include "output.h"
+#include "snap.h"
 #include <stdio.h>
 #include <strings.h>
 #include <memory.h> // strcpy and memcpy
+#include <sys/wait.h>
+#include <time.h>
 
 
 /***********************************************
@@ -10,6 +14,9 @@
 
 struct job_t jobs[MAXJOBS]; /* The job list */
 static int nextjid = 1;            /* next job ID to allocate */
+static struct done_t done[MAXDONE]; /* ring of finished jobs */
+static int donehead = 0;           /* next ring slot to fill */
+volatile int nexits = 0;
 
 
 /* clearjob - Clear the entries in a job struct */
@@ -18,6 +25,10 @@ void clearjob(struct job_t *job) {
     job->jid = 0;
     job->state = UNDEF;
     job->cmdline[0] = '\0';
+    job->start = 0;
+    job->leftover = 0;
+    job->status = 0;
+    job->has_tmodes = 0;
 }
 
 /* initjobs - Initialize the job list */
@@ -42,6 +53,7 @@ int maxjid(struct job_t *jobs)
 /* addjob - Add a job to the job list */
 int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline) 
 {
+    struct timespec ts;
     int i;
     
     if (pid < 1)
@@ -54,14 +66,18 @@ int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline)
 	    jobs[i].jid = nextjid++;
 	    if (nextjid > MAXJOBS)
 		nextjid = 1;
-	    strcpy(jobs[i].cmdline, cmdline);
+	    strncpy(jobs[i].cmdline, cmdline, MAXLINE - 1);   /* long lines are cut short */
+	    jobs[i].cmdline[MAXLINE - 1] = '\0';
+	    clock_gettime(CLOCK_REALTIME, &ts);
+	    jobs[i].start = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	    snap_publish();
   	    if(verbose){
-	        printf("Added job [%d] %d %s\n", jobs[i].jid, jobs[i].pid, jobs[i].cmdline);
+	        out_printf("Added job [%d] %d %s\n", jobs[i].jid, jobs[i].pid, jobs[i].cmdline);
             }
             return 1;
 	}
     }
-    printf("Tried to create too many jobs\n");
+    out_printf("Tried to create too many jobs\n");
     return 0;
 }
 
@@ -77,6 +93,7 @@ int deletejob(struct job_t *jobs, pid_t pid)
 	if (jobs[i].pid == pid) {
 	    clearjob(&jobs[i]);
 	    nextjid = maxjid(jobs)+1;
+	    snap_publish();
 	    return 1;
 	}
     }
@@ -139,25 +156,89 @@ void listjobs(struct job_t *jobs)
     
     for (i = 0; i < MAXJOBS; i++) {
 	if (jobs[i].pid != 0) {
-	    printf("[%d] (%d) ", jobs[i].jid, jobs[i].pid);
 	    switch (jobs[i].state) {
 		case BG: 
-		    printf("Running ");
+		    out_safef("[%d] (%d) Running %s", jobs[i].jid, jobs[i].pid, jobs[i].cmdline);
 		    break;
 		case FG: 
-		    printf("Foreground ");
+		    out_safef("[%d] (%d) Foreground %s", jobs[i].jid, jobs[i].pid, jobs[i].cmdline);
 		    break;
 		case ST: 
-		    printf("Stopped ");
+		    out_safef("[%d] (%d) Stopped %s", jobs[i].jid, jobs[i].pid, jobs[i].cmdline);
 		    break;
 	    default:
-		    printf("listjobs: Internal error: job[%d].state=%d ", 
-			   i, jobs[i].state);
+		    out_safef("[%d] (%d) listjobs: Internal error: job[%d].state=%d %s",
+			      jobs[i].jid, jobs[i].pid, i, jobs[i].state, jobs[i].cmdline);
 	    }
-	    printf("%s", jobs[i].cmdline);
 	}
     }
 }
+/* statuscode - Shell exit status for a waitpid status */
+int statuscode(int status)
+{
+    if (WIFEXITED(status))
+	return WEXITSTATUS(status);
+    if (WIFSIGNALED(status))
+	return 128 + WTERMSIG(status);
+    return 128 + WSTOPSIG(status);
+}
+
+/* recordexit - Remember how the job with PID=pid ended, before deletejob */
+void recordexit(struct job_t *jobs, pid_t pid, int status)
+{
+    struct done_t *d = &done[donehead];
+    struct job_t *job = getjobpid(jobs, pid);
+
+    d->pid = pid;
+    d->jid = job ? job->jid : 0;
+    d->status = statuscode(status);
+    d->fg = job != NULL && job->state == FG;
+    d->waited = job == NULL || d->fg;   /* the shell already waited */
+    donehead = (donehead + 1) % MAXDONE;
+    nexits++;
+}
+
+/* getdone - Find the most recent exit record for pid */
+struct done_t *getdone(pid_t pid)
+{
+    int i, k;
+
+    for (i = 1; i <= MAXDONE; i++) {
+	k = (donehead - i + MAXDONE) % MAXDONE;
+	if (done[k].pid == pid)
+	    return &done[k];
+    }
+    return NULL;
+}
+
+/*
+ * getdonejid - Find the most recent exit record of a background job
+ *    with ID jid; foreground jobs reuse IDs, but nothing waits for them
+ */
+struct done_t *getdonejid(int jid)
+{
+    int i, k;
+
+    for (i = 1; jid > 0 && i <= MAXDONE; i++) {
+	k = (donehead - i + MAXDONE) % MAXDONE;
+	if (done[k].pid != 0 && done[k].jid == jid && !done[k].fg)
+	    return &done[k];
+    }
+    return NULL;
+}
+
+/* nextdone - Oldest exit record not yet reported by wait, NULL if none */
+struct done_t *nextdone(void)
+{
+    int i, k;
+
+    for (i = 0; i < MAXDONE; i++) {
+	k = (donehead + i) % MAXDONE;
+	if (done[k].pid != 0 && !done[k].waited)
+	    return &done[k];
+    }
+    return NULL;
+}
 /******************************
  * end job list helper routines
  ******************************/
@@ -3,6 +3,7 @@
 #define _jobs_h_
 
 #include <sys/types.h> // needed for pid_t
+#include <termios.h>   // saved terminal modes
 #include "globals.h"
 
 /* Job states */
@@ -26,9 +27,23 @@ struct job_t {              /* The job struct */
     int jid;                /* job ID [1, 2, ...] */
     int state;              /* UNDEF, BG, FG, or ST */
     char cmdline[MAXLINE];  /* command line */
+    long long start;        /* CLOCK_REALTIME at launch, ns */
+    int leftover;           /* leader gone, rest of its group alive (tsh -r) */
+    int status;             /* then the leader's wait status */
+    int has_tmodes;         /* tmodes saved when the job last stopped */
+    struct termios tmodes;  /* its terminal modes */
 };
 extern struct job_t jobs[MAXJOBS]; /* The job list */
 
+struct done_t {             /* A finished job, kept for wait */
+    pid_t pid;              /* job PID */
+    int jid;                /* job ID it had */
+    int status;             /* exit status, 128+signal if killed */
+    int waited;             /* already reported by wait */
+    int fg;                 /* ended in the foreground */
+};
+extern volatile int nexits; /* bumped on every recorded exit */
+
 
 void clearjob(struct job_t *job);
 void initjobs(struct job_t *jobs);
@@ -40,6 +55,11 @@ struct job_t *getjobpid(struct job_t *jobs, pid_t pid);
 struct job_t *getjobjid(struct job_t *jobs, int jid); 
 int pid2jid(pid_t pid); 
 void listjobs(struct job_t *jobs);
+int statuscode(int status);
+void recordexit(struct job_t *jobs, pid_t pid, int status);
+struct done_t *getdone(pid_t pid);
+struct done_t *getdonejid(int jid);
+struct done_t *nextdone(void);
 
 
 #endif
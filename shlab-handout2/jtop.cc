@@ -0,0 +1,282 @@
+#include "jtop.h"
+#include "jobs.h"
+#include "vm.h"
+#include "helper-routines.h"
+#include "output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <time.h>
+
+/****************************************************
+ * jtop: per-job CPU/RSS sampling from /proc
+ *
+ * Every process seen under /proc is tracked in a
+ * table sorted by pid. Members of a job's process
+ * group keep their stat and statm files open and are
+ * re-read with pread; other processes are remembered
+ * only so that they are never opened again.
+ ****************************************************/
+
+struct proc_t {
+    pid_t pid;
+    pid_t pgid;                 /* process group, 0 if not a job member */
+    int statfd, statmfd;        /* open while pgid != 0 */
+    unsigned long long ticks;   /* utime + stime at the last sample */
+    unsigned long long dticks;  /* ticks used since the sample before */
+    long rss;                   /* resident pages */
+    char state;                 /* R, S, T, Z, ... */
+};
+
+struct jobrow_t {               /* one line of output */
+    struct job_t *job;
+    int nprocs;
+    double cpu;
+    long rss;
+};
+
+static struct proc_t *procs = NULL;
+static int nprocs = 0, capprocs = 0;
+
+/* readstat - Sample one process; returns 0 once it is gone */
+static int readstat(struct proc_t *p)
+{
+    char buf[1024], *s;
+    unsigned long long utime, stime;
+    long size, rss;
+    int n, pgid;
+
+    if ((n = pread(p->statfd, buf, sizeof(buf) - 1, 0)) <= 0)
+	return 0;
+    buf[n] = '\0';
+    if ((s = strrchr(buf, ')')) == NULL)
+	return 0;
+    /* state ppid pgrp session tty tpgid flags minflt cminflt majflt cmajflt utime stime */
+    if (sscanf(s + 2, "%c %*d %d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+	       &p->state, &pgid, &utime, &stime) != 4)
+	return 0;
+    p->pgid = pgid;
+    p->dticks = utime + stime - p->ticks;
+    p->ticks = utime + stime;
+
+    if (p->statmfd >= 0 && (n = pread(p->statmfd, buf, sizeof(buf) - 1, 0)) > 0) {
+	buf[n] = '\0';
+	if (sscanf(buf, "%ld %ld", &size, &rss) == 2)
+	    p->rss = rss;
+    }
+    return 1;
+}
+
+/* ismember - Is pgid the process group of a job? */
+static int ismember(pid_t pgid)
+{
+    int i;
+
+    for (i = 0; i < MAXJOBS; i++)
+	if (jobs[i].pid != 0 && jobs[i].pid == pgid)
+	    return 1;
+    return 0;
+}
+
+/* closeproc - Drop the open files of a tracked process */
+static void closeproc(struct proc_t *p)
+{
+    if (p->statfd >= 0)
+	close(p->statfd);
+    if (p->statmfd >= 0)
+	close(p->statmfd);
+    p->statfd = p->statmfd = -1;
+}
+
+/* newproc - Start tracking pid: open it if it belongs to a job */
+static void newproc(struct proc_t *p, pid_t pid)
+{
+    char path[64];
+
+    memset(p, 0, sizeof(*p));
+    p->pid = pid;
+    p->statfd = p->statmfd = -1;
+    sprintf(path, "/proc/%d/stat", pid);
+    if ((p->statfd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+	return;
+    if (!readstat(p) || !ismember(p->pgid)) {
+	closeproc(p);
+	p->pgid = 0;
+	return;
+    }
+    p->dticks = 0;                      /* no rate until the next sample */
+    sprintf(path, "/proc/%d/statm", pid);
+    p->statmfd = open(path, O_RDONLY | O_CLOEXEC);
+    readstat(p);
+    p->dticks = 0;
+}
+
+static int cmppid(const void *a, const void *b)
+{
+    return *(const pid_t *)a - *(const pid_t *)b;
+}
+
+/*
+ * sample - Merge the pids now under /proc into the table: new pids
+ *    are classified once, vanished ones are dropped, members re-read.
+ */
+static void sample(void)
+{
+    static pid_t *pids = NULL;
+    static int cappids = 0;
+    struct proc_t *old = procs;
+    int nold = nprocs, npids = 0, i, j;
+    struct dirent *de;
+    DIR *dir;
+
+    if ((dir = opendir("/proc")) == NULL)
+	return;
+    while ((de = readdir(dir)) != NULL) {
+	if (de->d_name[0] < '1' || de->d_name[0] > '9')
+	    continue;
+	if (npids == cappids) {
+	    cappids = cappids ? 2 * cappids : 512;
+	    if ((pids = (pid_t *)realloc(pids, cappids * sizeof(pid_t))) == NULL)
+		unix_error("jtop: realloc error");
+	}
+	pids[npids++] = atoi(de->d_name);
+    }
+    closedir(dir);
+    qsort(pids, npids, sizeof(pid_t), cmppid);
+
+    capprocs = npids > 0 ? npids : 1;
+    if ((procs = (struct proc_t *)malloc(capprocs * sizeof(struct proc_t))) == NULL)
+	unix_error("jtop: malloc error");
+    nprocs = 0;
+    for (i = j = 0; i < npids; i++) {
+	while (j < nold && old[j].pid < pids[i])
+	    closeproc(&old[j++]);               /* gone */
+	if (j < nold && old[j].pid == pids[i]) {
+	    procs[nprocs] = old[j++];
+	    if (procs[nprocs].statfd >= 0 && !readstat(&procs[nprocs])) {
+		closeproc(&procs[nprocs]);
+		continue;
+	    }
+	}
+	else
+	    newproc(&procs[nprocs], pids[i]);
+	nprocs++;
+    }
+    while (j < nold)
+	closeproc(&old[j++]);
+    free(old);
+}
+
+static int cmprow(const void *a, const void *b)
+{
+    const struct jobrow_t *x = (const struct jobrow_t *)a;
+    const struct jobrow_t *y = (const struct jobrow_t *)b;
+
+    if (x->cpu != y->cpu)
+	return x->cpu < y->cpu ? 1 : -1;
+    return x->job->jid - y->job->jid;
+}
+
+/* fmtsize - Human-readable byte count */
+static void fmtsize(char *buf, double bytes)
+{
+    const char *units = "BKMGT";
+
+    while (bytes >= 1024 && units[1]) {
+	bytes /= 1024;
+	units++;
+    }
+    sprintf(buf, *units == 'B' ? "%.0f%c" : "%.1f%c", bytes, *units);
+}
+
+/* show - Print one frame */
+static void show(double secs, int clear)
+{
+    static long hz = 0, pagesize = 0;
+    struct jobrow_t rows[MAXJOBS];
+    int nrows = 0, i, k;
+    const char *state;
+    char rss[32];
+
+    if (!hz) {
+	hz = sysconf(_SC_CLK_TCK);
+	pagesize = sysconf(_SC_PAGESIZE);
+    }
+    for (i = 0; i < MAXJOBS; i++) {
+	if (jobs[i].pid == 0)
+	    continue;
+	rows[nrows].job = &jobs[i];
+	rows[nrows].nprocs = 0;
+	rows[nrows].cpu = 0;
+	rows[nrows].rss = 0;
+	for (k = 0; k < nprocs; k++)
+	    if (procs[k].pgid == jobs[i].pid) {
+		rows[nrows].nprocs++;
+		rows[nrows].cpu += secs > 0 ? 100.0 * procs[k].dticks / (hz * secs) : 0;
+		rows[nrows].rss += procs[k].rss;
+	    }
+	nrows++;
+    }
+    qsort(rows, nrows, sizeof(rows[0]), cmprow);
+
+    if (clear)
+	out_printf("\033[H\033[J");
+    out_printf("%5s %7s %5s %6s %7s %-10s %s\n",
+	       "JID", "PID", "PROCS", "CPU%", "RSS", "STATE", "COMMAND");
+    for (i = 0; i < nrows; i++) {
+	struct job_t *job = rows[i].job;
+	state = job->state == BG ? "Running" : job->state == FG ? "Foreground" : "Stopped";
+	fmtsize(rss, (double)rows[i].rss * pagesize);
+	out_printf("%5d %7d %5d %6.1f %7s %-10s %s",
+		   job->jid, job->pid, rows[i].nprocs, rows[i].cpu, rss, state, job->cmdline);
+	if (job->cmdline[0] && job->cmdline[strlen(job->cmdline) - 1] != '\n')
+	    out_printf("\n");
+    }
+    out_flush();
+}
+
+/*
+ * jtop - Show frames every interval_ms until frames have been shown
+ *    (frames <= 0: until ctrl-c). Returns 0, or 130 if interrupted.
+ */
+int jtop(int interval_ms, int frames)
+{
+    int clear = isatty(STDOUT_FILENO), shown = 0, rc = 0;
+    struct timespec ts, rem;
+    long long t0, t1;
+
+    vm_interrupt = 0;
+    sample();
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    t0 = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    while (frames <= 0 || shown < frames) {
+	ts.tv_sec = interval_ms / 1000;
+	ts.tv_nsec = (interval_ms % 1000) * 1000000L;
+	while (nanosleep(&ts, &rem) < 0 && errno == EINTR && !vm_interrupt)
+	    ts = rem;
+	if (vm_interrupt) {
+	    rc = 128 + 2;
+	    break;
+	}
+	sample();
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	t1 = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	show((t1 - t0) / 1e9, clear);
+	t0 = t1;
+	shown++;
+    }
+
+    for (int i = 0; i < nprocs; i++)
+	closeproc(&procs[i]);
+    free(procs);
+    procs = NULL;
+    nprocs = 0;
+    return rc;
+}
+/*****************************
+ * end jtop
+ *****************************/
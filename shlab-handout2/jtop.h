@@ -0,0 +1,11 @@
+//-*-c++-*-
+#ifndef _jtop_h_
+#define _jtop_h_
+
+/*
+ * jtop - Live per-job CPU and memory view, sampled from /proc for
+ *    every process in each job's process group.
+ */
+int jtop(int interval_ms, int frames);
+
+#endif
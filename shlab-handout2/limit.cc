@@ -0,0 +1,188 @@
+#include "limit.h"
+#include "vm.h"
+#include "timer.h"
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+
+/*********************************
+ * Spawn admission control
+ *********************************/
+
+static double rate = 0;         /* tokens per second, 0 for no limit */
+static int burst = 1;           /* bucket size */
+static int maxlive = 0;         /* jobs at once, 0 for no limit */
+
+static double tokens = 0;       /* in the bucket as of refilled */
+static long long refilled = 0;
+
+static int live = 0;            /* reserved or alive; atomic, sigchld_handler lowers it */
+static struct limit_stats stats;
+
+/* refill - Add the tokens earned since the last refill */
+static void refill(long long now)
+{
+    tokens += (now - refilled) * rate / 1e9;
+    if (tokens > burst)
+	tokens = burst;
+    refilled = now;
+}
+
+/*
+ * limit_set - Allow rate launches per second on average and burst at
+ *    once, and at most maxlive jobs alive. 0 turns a limit off.
+ */
+void limit_set(double r, int b, int m)
+{
+    rate = r > 0 ? r : 0;
+    burst = b > 0 ? b : 1;
+    maxlive = m > 0 ? m : 0;
+    tokens = burst;             /* start full */
+    refilled = timer_now();
+}
+
+void limit_get(double *r, int *b, int *m)
+{
+    *r = rate;
+    *b = burst;
+    *m = maxlive;
+}
+
+/* reserve - Count a launch as alive from the moment it is admitted */
+static void reserve(void)
+{
+    int n = __atomic_add_fetch(&live, 1, __ATOMIC_RELAXED);
+
+    if (n > stats.peak)
+	stats.peak = n;
+}
+
+/*
+ * limit_admit - Wait until a launch fits both limits, take its token
+ *    and reserve its slot among the live children, so that launches
+ *    admitted together before any of them forks still respect the
+ *    ceiling. The caller gives the slot back with limit_cancel() if
+ *    the launch then fails. Sleeps with SIGCHLD let in, so exiting
+ *    children are reaped and free their slots meanwhile. Returns 0, or
+ *    -1 if ctrl-c came first (vm_interrupt is left set, so a running
+ *    loop stops too).
+ */
+int limit_admit(void)
+{
+    sigset_t mask, prev, sleepmask;
+    struct timespec ts, *tp;
+    long long now, t0 = 0, wait;
+    int rc = 0;
+
+    if (rate == 0 && maxlive == 0) {
+	stats.admitted++;
+	reserve();
+	return 0;
+    }
+
+    /*
+     * ctrl-c and SIGCHLD only get in while we sleep, so none is missed;
+     * they do then even if the caller (batch -P, say) had blocked them
+     */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigprocmask(SIG_BLOCK, &mask, &prev);
+    sleepmask = prev;
+    sigdelset(&sleepmask, SIGCHLD);
+    sigdelset(&sleepmask, SIGINT);
+    for (;;) {
+	now = timer_now();
+	if (rate > 0)
+	    refill(now);
+	if (t0 != 0 && vm_interrupt) {
+	    stats.interrupted++;
+	    rc = -1;
+	    break;
+	}
+	if ((rate == 0 || tokens >= 1) &&
+	    (maxlive == 0 || __atomic_load_n(&live, __ATOMIC_RELAXED) < maxlive))
+	    break;
+	if (t0 == 0) {
+	    t0 = now;
+	    stats.delayed++;
+	    vm_interrupt = 0;           /* only a ctrl-c from now on counts */
+	}
+	tp = NULL;                      /* until a child exits */
+	if (maxlive == 0 || __atomic_load_n(&live, __ATOMIC_RELAXED) < maxlive) {
+	    wait = (long long)((1 - tokens) * 1e9 / rate) + 1;
+	    ts.tv_sec = wait / 1000000000LL;
+	    ts.tv_nsec = wait % 1000000000LL;
+	    tp = &ts;
+	}
+	ppoll(NULL, 0, tp, &sleepmask);
+    }
+    if (rc == 0) {
+	if (rate > 0)
+	    tokens -= 1;
+	stats.admitted++;
+	reserve();
+    }
+    if (t0 != 0)
+	stats.waited += timer_now() - t0;
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+    return rc;
+}
+
+/*
+ * limit_tryadmit - Admit a launch, as limit_admit() does, only if it
+ *    fits both limits right now. Returns 0 if admitted, else -1.
+ */
+int limit_tryadmit(void)
+{
+    sigset_t mask, prev;
+    int rc = -1;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &prev);
+    if (rate > 0)
+	refill(timer_now());
+    if ((rate == 0 || tokens >= 1) &&
+	(maxlive == 0 || __atomic_load_n(&live, __ATOMIC_RELAXED) < maxlive)) {
+	if (rate > 0)
+	    tokens -= 1;
+	stats.admitted++;
+	reserve();
+	rc = 0;
+    }
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+    return rc;
+}
+
+/* limit_cancel - An admitted launch failed: give its slot back */
+void limit_cancel(void)
+{
+    limit_reaped();
+}
+
+/* limit_detach - Count none alive: those are the shell's (a subshell's) */
+void limit_detach(void)
+{
+    __atomic_store_n(&live, 0, __ATOMIC_RELAXED);
+}
+
+/* limit_reaped - A child exited or was killed; from sigchld_handler */
+void limit_reaped(void)
+{
+    int n = __atomic_load_n(&live, __ATOMIC_RELAXED);
+
+    while (n > 0 && !__atomic_compare_exchange_n(&live, &n, n - 1, 0, __ATOMIC_RELAXED,
+						 __ATOMIC_RELAXED))
+	;
+}
+
+/* limit_counters - The counters so far, and the jobs alive now */
+void limit_counters(struct limit_stats *s)
+{
+    *s = stats;
+    s->live = __atomic_load_n(&live, __ATOMIC_RELAXED);
+}
+/*****************************
+ * end spawn admission control
+ *****************************/
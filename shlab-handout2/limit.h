@@ -0,0 +1,33 @@
+//-*-c++-*-
+#ifndef _limit_h_
+#define _limit_h_
+
+/*
+ * Admission control for spawn(). A token bucket holds up to burst
+ * tokens and refills at rate per second; every launch takes one. A
+ * second limit caps the jobs alive at once (running or stopped); it
+ * counts the processes the shell started, not the ones those start in
+ * turn. A launch over either limit is delayed
+ * until it fits, never refused, so a runaway loop slows down instead
+ * of filling the host with processes. Both limits are off (0) until
+ * the limit builtin sets them.
+ */
+
+struct limit_stats {
+    unsigned long admitted;     /* launches let through */
+    unsigned long delayed;      /* of which had to wait */
+    unsigned long interrupted;  /* waits cut short by ctrl-c */
+    long long waited;           /* total time spent waiting, ns */
+    int live, peak;             /* jobs alive now, and at most */
+};
+
+void limit_set(double rate, int burst, int maxlive);
+void limit_get(double *rate, int *burst, int *maxlive);
+int limit_admit(void);
+int limit_tryadmit(void);
+void limit_cancel(void);
+void limit_reaped(void);
+void limit_detach(void);
+void limit_counters(struct limit_stats *s);
+
+#endif
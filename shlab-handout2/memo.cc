@@ -0,0 +1,503 @@
+#include "memo.h"
+#include "env.h"
+#include "helper-routines.h"
+#include "output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/**********************************************
+ * Helper routines for memoized command results
+ **********************************************/
+
+struct entry_t {            /* a stored result, while evicting */
+    char name[MEMO_KEYLEN];
+    long long atime;        /* last use (the key file's mtime), ns */
+    long size;              /* bytes of output it holds */
+};
+
+#define SWEEPLEN (4096 + 2 * 256 + 16)  /* dir/objects/xx/rest, entries up to 255 bytes */
+
+static char dir[4096];                  /* the store, once located */
+static char tmppath[3][4096 + 16];      /* capture files */
+static unsigned long hits = 0, misses = 0, stores = 0, evictions = 0;
+static long used = -1;                  /* store size as of the last scan, plus
+					   what we stored since; -1 until scanned */
+
+/*
+ * 128-bit FNV-1a, so that a key or blob collision is out of the
+ * question in practice.
+ */
+typedef unsigned __int128 hash_t;
+
+static hash_t hash_init(void)
+{
+    return ((hash_t)0x6c62272e07bb0142ULL << 64) | 0x62b821756295c58dULL;
+}
+
+static hash_t hash_add(hash_t h, const void *buf, long len)
+{
+    const hash_t prime = ((hash_t)1 << 88) | 0x13b;
+    const unsigned char *p = (const unsigned char *)buf;
+    long i;
+
+    for (i = 0; i < len; i++) {
+	h ^= p[i];
+	h *= prime;
+    }
+    return h;
+}
+
+static void hash_hex(hash_t h, char *hex)
+{
+    sprintf(hex, "%016llx%016llx", (unsigned long long)(h >> 64), (unsigned long long)h);
+}
+
+/* hash_fd - Hash everything readable from fd; -1 on a read error */
+static int hash_fd(int fd, hash_t *h)
+{
+    char buf[65536];
+    int n;
+
+    while ((n = read(fd, buf, sizeof(buf))) != 0) {
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return -1;
+	}
+	*h = hash_add(*h, buf, n);
+    }
+    return 0;
+}
+
+/* store_dir - Locate (and create) the store; NULL if that fails */
+static const char *store_dir(void)
+{
+    static const char *subdirs[] = { "", "/keys", "/objects", "/tmp" };
+    const char *s;
+    char path[4096 + 16], *p;
+    unsigned i;
+
+    if (dir[0] != '\0')
+	return dir;
+    if ((s = env_get("TSH_CACHE_DIR")) != NULL && *s)
+	snprintf(dir, sizeof(dir), "%s", s);
+    else if ((s = env_get("HOME")) != NULL && *s)
+	snprintf(dir, sizeof(dir), "%s/.cache/tsh", s);
+    else
+	snprintf(dir, sizeof(dir), "/tmp/tsh-cache-%d", (int)getuid());
+
+    for (p = dir + 1; (p = strchr(p, '/')) != NULL; p++) {   /* mkdir -p */
+	*p = '\0';
+	mkdir(dir, 0700);
+	*p = '/';
+    }
+    for (i = 0; i < sizeof(subdirs) / sizeof(subdirs[0]); i++) {
+	snprintf(path, sizeof(path), "%s%s", dir, subdirs[i]);
+	if (mkdir(path, 0700) < 0 && errno != EEXIST) {
+	    out_printf("cache: %s: %s\n", path, strerror(errno));
+	    dir[0] = '\0';
+	    return NULL;
+	}
+    }
+    return dir;
+}
+
+/* maxsize - The store's size bound, from $TSH_CACHE_MAX (K/M/G suffixes) */
+static long maxsize(void)
+{
+    const char *s = env_get("TSH_CACHE_MAX");
+    char *end;
+    long n;
+
+    if (s == NULL || (n = strtol(s, &end, 10)) <= 0)
+	return MEMO_MAXSIZE;
+    switch (*end) {
+    case 'G': case 'g': n <<= 10;
+	/* fallthrough */
+    case 'M': case 'm': n <<= 10;
+	/* fallthrough */
+    case 'K': case 'k': n <<= 10;
+    }
+    return n;
+}
+
+/*
+ * memo_key - Compute the key for running argv: its words, the working
+ *    directory, the named variables, the executable's identity and
+ *    each input file's content hash (or, with usemtime, its size and
+ *    mtime). Returns 0, or -1 if an input cannot be read.
+ */
+int memo_key(char **argv, char **inputs, char **vars, int usemtime, char *key)
+{
+    hash_t h = hash_add(hash_init(), "tsh-cache-1", 12);
+    char cwd[4096];
+    const char *v;
+    struct stat sb;
+    long long ident[4];
+    int i, fd;
+
+    if (getcwd(cwd, sizeof(cwd)) != NULL)
+	h = hash_add(h, cwd, strlen(cwd) + 1);
+    for (i = 0; argv[i] != NULL; i++)
+	h = hash_add(h, argv[i], strlen(argv[i]) + 1);
+    h = hash_add(h, "", 1);
+    for (i = 0; vars[i] != NULL; i++) {
+	h = hash_add(h, vars[i], strlen(vars[i]) + 1);
+	if ((v = env_get(vars[i])) != NULL)
+	    h = hash_add(h, v, strlen(v) + 1);
+	else
+	    h = hash_add(h, "\377", 1);     /* unset differs from empty */
+    }
+    if (stat(argv[0], &sb) == 0) {      /* a rebuilt program is a new key */
+	ident[0] = sb.st_ino;
+	ident[1] = sb.st_size;
+	ident[2] = sb.st_mtim.tv_sec;
+	ident[3] = sb.st_mtim.tv_nsec;
+	h = hash_add(h, ident, sizeof(ident));
+    }
+    for (i = 0; inputs[i] != NULL; i++) {
+	h = hash_add(h, inputs[i], strlen(inputs[i]) + 1);
+	if ((fd = open(inputs[i], O_RDONLY | O_CLOEXEC)) < 0 || fstat(fd, &sb) < 0) {
+	    out_printf("cache: %s: %s\n", inputs[i], strerror(errno));
+	    if (fd >= 0)
+		close(fd);
+	    return -1;
+	}
+	if (usemtime) {
+	    ident[0] = sb.st_ino;
+	    ident[1] = sb.st_size;
+	    ident[2] = sb.st_mtim.tv_sec;
+	    ident[3] = sb.st_mtim.tv_nsec;
+	    h = hash_add(h, ident, sizeof(ident));
+	}
+	else if (hash_fd(fd, &h) < 0) {
+	    out_printf("cache: %s: %s\n", inputs[i], strerror(errno));
+	    close(fd);
+	    return -1;
+	}
+	close(fd);
+    }
+    hash_hex(h, key);
+    return 0;
+}
+
+/* blobpath - Where the blob with hex hash name lives */
+static void blobpath(char *path, int size, const char *name)
+{
+    snprintf(path, size, "%s/objects/%.2s/%s", dir, name, name + 2);
+}
+
+/* hasblob - Is the blob with hex hash name in the store? */
+static int hasblob(const char *name)
+{
+    char path[4096 + 64];
+
+    blobpath(path, sizeof(path), name);
+    return access(path, F_OK) == 0;
+}
+
+/* replayblob - Copy a stored blob to our output; -1 if it is gone */
+static int replayblob(const char *name)
+{
+    char path[4096 + 64], buf[65536];
+    int fd, n;
+
+    blobpath(path, sizeof(path), name);
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+	return -1;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+	out_put(buf, n);
+    close(fd);
+    return 0;
+}
+
+/*
+ * memo_replay - On a hit, print the stored stdout and stderr and
+ *    return the stored exit status; -1 on a miss
+ */
+int memo_replay(const char *key)
+{
+    char path[4096 + 64], line[256], out[MEMO_KEYLEN], err[MEMO_KEYLEN];
+    long outsize, errsize;
+    int fd, n, status;
+
+    if (store_dir() == NULL)
+	return -1;
+    snprintf(path, sizeof(path), "%s/keys/%s", dir, key);
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+	misses++;
+	return -1;
+    }
+    n = read(fd, line, sizeof(line) - 1);
+    close(fd);
+    line[n > 0 ? n : 0] = '\0';
+    if (sscanf(line, "%d %32s %ld %32s %ld", &status, out, &outsize, err, &errsize) != 5) {
+	misses++;
+	return -1;
+    }
+    if (!hasblob(out) || !hasblob(err)) {
+	unlink(path);                   /* evicted from under us */
+	misses++;
+	return -1;
+    }
+    replayblob(out);
+    replayblob(err);
+    utimensat(AT_FDCWD, path, NULL, 0); /* mark it recently used */
+    hits++;
+    return status;
+}
+
+/*
+ * memo_capture - Open files to catch a command's stdout (fds[1]) and
+ *    stderr (fds[2]); fds[0] is -1, stdin stays the shell's.
+ */
+int memo_capture(int fds[3])
+{
+    int i;
+
+    fds[0] = fds[1] = fds[2] = -1;
+    if (store_dir() == NULL)
+	return -1;
+    for (i = 1; i <= 2; i++) {
+	snprintf(tmppath[i], sizeof(tmppath[i]), "%s/tmp/out.XXXXXX", dir);
+	if ((fds[i] = mkostemp(tmppath[i], O_CLOEXEC)) < 0) {
+	    out_printf("cache: %s: %s\n", tmppath[i], strerror(errno));
+	    memo_discard(fds);
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+/* memo_show - Print what a capture caught, stdout first */
+void memo_show(int fds[3])
+{
+    char buf[65536];
+    int i, n;
+
+    for (i = 1; i <= 2; i++) {
+	if (fds[i] < 0 || lseek(fds[i], 0, SEEK_SET) < 0)
+	    continue;
+	while ((n = read(fds[i], buf, sizeof(buf))) > 0)
+	    out_put(buf, n);
+    }
+}
+
+/* memo_discard - Throw away a capture */
+void memo_discard(int fds[3])
+{
+    int i;
+
+    for (i = 1; i <= 2; i++)
+	if (fds[i] >= 0) {
+	    close(fds[i]);
+	    unlink(tmppath[i]);
+	    fds[i] = -1;
+	}
+}
+
+/* addblob - Move capture i into the store under its content hash */
+static int addblob(int i, int fd, char *name, long *size)
+{
+    char path[4096 + 64];
+    hash_t h = hash_init();
+    struct stat sb;
+    char *slash;
+
+    if (lseek(fd, 0, SEEK_SET) < 0 || hash_fd(fd, &h) < 0 || fstat(fd, &sb) < 0)
+	return -1;
+    *size = sb.st_size;
+    hash_hex(h, name);
+    blobpath(path, sizeof(path), name);
+    if (access(path, F_OK) == 0)        /* already stored */
+	return unlink(tmppath[i]);
+    slash = strrchr(path, '/');
+    *slash = '\0';
+    mkdir(path, 0700);
+    *slash = '/';
+    return rename(tmppath[i], path);
+}
+
+/* byatime - qsort order for eviction: least recently used first */
+static int byatime(const void *a, const void *b)
+{
+    const struct entry_t *x = (const struct entry_t *)a, *y = (const struct entry_t *)b;
+
+    return x->atime < y->atime ? -1 : x->atime > y->atime;
+}
+
+/* byname - qsort and bsearch order for the blobs still in use */
+static int byname(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*
+ * evict - Drop least recently used results until the store is under
+ *    limit bytes, then delete the blobs no remaining result uses.
+ *    Returns the number of results dropped, and leaves the store's
+ *    size in used.
+ */
+static int evict(long limit)
+{
+    char path[SWEEPLEN], line[256], out[MEMO_KEYLEN], err[MEMO_KEYLEN], name[MEMO_KEYLEN];
+    char *np = name;
+    struct entry_t *ents = NULL;
+    struct dirent *de, *be;
+    struct stat sb;
+    DIR *dp, *bp;
+    long total = 0, outsize, errsize;
+    int n = 0, cap = 0, i, fd, len, status, dropped;
+    char **keep = NULL;
+
+    snprintf(path, sizeof(path), "%s/keys", dir);
+    if ((dp = opendir(path)) == NULL)
+	return 0;
+    while ((de = readdir(dp)) != NULL) {
+	if (de->d_name[0] == '.' || strlen(de->d_name) != MEMO_KEYLEN - 1)
+	    continue;
+	snprintf(path, sizeof(path), "%s/keys/%s", dir, de->d_name);
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+	    continue;
+	len = read(fd, line, sizeof(line) - 1);
+	fstat(fd, &sb);
+	close(fd);
+	line[len > 0 ? len : 0] = '\0';
+	if (sscanf(line, "%d %32s %ld %32s %ld", &status, out, &outsize, err, &errsize) != 5)
+	    continue;
+	if (n == cap) {
+	    cap = cap ? 2 * cap : 64;
+	    if ((ents = (struct entry_t *)realloc(ents, cap * sizeof(*ents))) == NULL)
+		unix_error("cache: realloc error");
+	}
+	strcpy(ents[n].name, de->d_name);
+	ents[n].atime = sb.st_mtim.tv_sec * 1000000000LL + sb.st_mtim.tv_nsec;
+	ents[n].size = outsize + errsize;
+	total += ents[n++].size;
+    }
+    closedir(dp);
+    if (total <= limit) {
+	used = total;
+	free(ents);
+	return 0;
+    }
+
+    qsort(ents, n, sizeof(*ents), byatime);
+    for (i = 0; i < n && total > limit; i++) {
+	snprintf(path, sizeof(path), "%s/keys/%s", dir, ents[i].name);
+	unlink(path);
+	total -= ents[i].size;
+    }
+    dropped = i;
+    used = total;
+
+    /* the blobs still in use */
+    if ((keep = (char **)malloc(2 * (n - i) * sizeof(char *) + 1)) == NULL)
+	unix_error("cache: malloc error");
+    for (len = 0; i < n; i++) {
+	snprintf(path, sizeof(path), "%s/keys/%s", dir, ents[i].name);
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+	    continue;
+	status = read(fd, line, sizeof(line) - 1);
+	close(fd);
+	line[status > 0 ? status : 0] = '\0';
+	if (sscanf(line, "%d %32s %ld %32s %ld", &status, out, &outsize, err, &errsize) == 5) {
+	    keep[len++] = strdup(out);
+	    keep[len++] = strdup(err);
+	}
+    }
+    qsort(keep, len, sizeof(*keep), byname);
+    snprintf(path, sizeof(path), "%s/objects", dir);
+    if ((dp = opendir(path)) != NULL) {
+	while ((de = readdir(dp)) != NULL) {
+	    if (de->d_name[0] == '.')
+		continue;
+	    snprintf(path, sizeof(path), "%s/objects/%s", dir, de->d_name);
+	    if ((bp = opendir(path)) == NULL)
+		continue;
+	    while ((be = readdir(bp)) != NULL) {
+		if (be->d_name[0] == '.')
+		    continue;
+		if (snprintf(name, sizeof(name), "%.2s%s", de->d_name, be->d_name) >= (int)sizeof(name) ||
+		    bsearch(&np, keep, len, sizeof(*keep), byname) == NULL) {
+		    snprintf(path, sizeof(path), "%s/objects/%s/%s", dir, de->d_name, be->d_name);
+		    unlink(path);
+		}
+	    }
+	    closedir(bp);
+	}
+	closedir(dp);
+    }
+    for (i = 0; i < len; i++)
+	free(keep[i]);
+    free(keep);
+    free(ents);
+    return dropped;
+}
+
+/*
+ * memo_store - Keep a finished capture as the result for key, then
+ *    bring the store back under its size bound
+ */
+void memo_store(const char *key, int fds[3], int status)
+{
+    char path[4096 + 64], tmp[4096 + 64], line[256], out[MEMO_KEYLEN], err[MEMO_KEYLEN];
+    long outsize, errsize;
+    int fd, n;
+
+    if (addblob(1, fds[1], out, &outsize) < 0 || addblob(2, fds[2], err, &errsize) < 0) {
+	memo_discard(fds);
+	return;
+    }
+    close(fds[1]);
+    close(fds[2]);
+    fds[1] = fds[2] = -1;
+
+    n = snprintf(line, sizeof(line), "%d %s %ld %s %ld\n", status, out, outsize, err, errsize);
+    snprintf(tmp, sizeof(tmp), "%s/tmp/key.%d", dir, (int)getpid());
+    snprintf(path, sizeof(path), "%s/keys/%s", dir, key);
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0)
+	return;
+    if (write(fd, line, n) != n) {
+	close(fd);
+	unlink(tmp);
+	return;
+    }
+    if (close(fd) < 0 || rename(tmp, path) < 0) {
+	unlink(tmp);
+	return;
+    }
+    stores++;
+    if (used >= 0)
+	used += outsize + errsize;
+    if (used < 0 || used > maxsize())   /* rescan only when it may be over */
+	evictions += evict(maxsize());
+}
+
+/* memo_stats - Print this session's hit rate and the store's location */
+void memo_stats(void)
+{
+    unsigned long total = hits + misses;
+
+    out_printf("cache: %lu hits, %lu misses (%.1f%% hit rate), %lu stored, %lu evicted, store %s\n",
+	       hits, misses, total ? 100.0 * hits / total : 0.0, stores, evictions,
+	       store_dir() ? dir : "(none)");
+}
+
+/* memo_clear - Remove every stored result */
+int memo_clear(void)
+{
+    if (store_dir() == NULL)
+	return -1;
+    evict(-1);
+    return 0;
+}
+/*****************************
+ * end memoized results
+ *****************************/
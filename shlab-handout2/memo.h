@@ -0,0 +1,29 @@
+//-*-c++-*-
+#ifndef _memo_h_
+#define _memo_h_
+
+/*
+ * Memoized command results for the cache builtin. A command's result
+ * (its stdout, stderr and exit status) is stored on disk under a key
+ * built from its argv, the working directory, selected variables, the
+ * executable and its input files. Output blobs are content-addressed,
+ * so identical outputs are stored once.
+ *
+ * The store lives in $TSH_CACHE_DIR (default ~/.cache/tsh) and is kept
+ * under $TSH_CACHE_MAX bytes (default MEMO_MAXSIZE) by evicting the
+ * least recently used results.
+ */
+
+#define MEMO_KEYLEN  33                 /* 128-bit hash in hex, plus NUL */
+#define MEMO_MAXSIZE (64L << 20)        /* default store size bound */
+
+int memo_key(char **argv, char **inputs, char **vars, int usemtime, char *key);
+int memo_replay(const char *key);
+int memo_capture(int fds[3]);
+void memo_show(int fds[3]);
+void memo_store(const char *key, int fds[3], int status);
+void memo_discard(int fds[3]);
+void memo_stats(void);
+int memo_clear(void);
+
+#endif
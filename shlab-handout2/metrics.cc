@@ -0,0 +1,227 @@
+#include "metrics.h"
+#include "jobs.h"
+#include "ctl.h"
+#include "timer.h"
+#include "limit.h"
+#include "helper-routines.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*****************************************
+ * Shell metrics (Prometheus text format)
+ *****************************************/
+
+#define NBUCKETS 10
+
+struct hist_t {
+    const long long *bounds;            /* bucket upper bounds, ns */
+    unsigned long counts[NBUCKETS + 1]; /* last one is +Inf */
+    unsigned long long sum;             /* ns */
+    unsigned long count;
+};
+
+/* Bucket bounds (ns): fork+exec setup vs. delays within sigchld_handler */
+static const long long spawn_bounds[NBUCKETS] = {
+    25000, 50000, 100000, 250000, 500000,
+    1000000, 2500000, 5000000, 10000000, 50000000
+};
+static const long long reap_bounds[NBUCKETS] = {
+    1000, 5000, 10000, 25000, 50000,
+    100000, 250000, 500000, 1000000, 10000000
+};
+
+static unsigned long started, reaped, stopped, killed, orphans;
+static struct hist_t spawn_hist = { spawn_bounds, { 0 }, 0, 0 };
+static struct hist_t reap_hist = { reap_bounds, { 0 }, 0, 0 };
+
+static char *textfile = NULL;           /* node_exporter textfile, if any */
+static long long nextwrite = 0;
+
+#define INC(x)      __atomic_fetch_add(&(x), 1, __ATOMIC_RELAXED)
+#define ADD(x, n)   __atomic_fetch_add(&(x), (n), __ATOMIC_RELAXED)
+#define LOAD(x)     __atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+static void observe(struct hist_t *h, long long ns)
+{
+    int i;
+
+    for (i = 0; i < NBUCKETS && ns > h->bounds[i]; i++)
+	;
+    INC(h->counts[i]);
+    ADD(h->sum, (unsigned long long)ns);
+    INC(h->count);
+}
+
+/* metrics_spawned - A job was started; ns is the time spawn() took */
+void metrics_spawned(long long ns)
+{
+    INC(started);
+    observe(&spawn_hist, ns);
+}
+
+/* metrics_reaped - A job ended; ns is from sigchld_handler's entry to its reaping */
+void metrics_reaped(int signaled, long long ns)
+{
+    INC(reaped);
+    if (signaled)
+	INC(killed);
+    observe(&reap_hist, ns);
+}
+
+/* metrics_stopped - A job was stopped */
+void metrics_stopped(void)
+{
+    INC(stopped);
+}
+
+/* metrics_orphaned - An orphaned descendant of a job was reaped (tsh -r) */
+void metrics_orphaned(void)
+{
+    INC(orphans);
+}
+
+/*
+ * Formatting
+ */
+
+struct out_t {
+    char *buf;
+    int len, cap;
+};
+
+static void put(struct out_t *o, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    for (;;) {
+	va_start(ap, fmt);
+	n = vsnprintf(o->buf + o->len, o->cap - o->len, fmt, ap);
+	va_end(ap);
+	if (n < o->cap - o->len)
+	    break;
+	o->cap = 2 * o->cap + n;
+	if ((o->buf = (char *)realloc(o->buf, o->cap)) == NULL)
+	    unix_error("metrics: realloc error");
+    }
+    o->len += n;
+}
+
+static void counter(struct out_t *o, const char *name, const char *help, unsigned long v)
+{
+    put(o, "# HELP %s %s\n# TYPE %s counter\n%s %lu\n", name, help, name, name, v);
+}
+
+static void histogram(struct out_t *o, const char *name, const char *help, struct hist_t *h)
+{
+    unsigned long cum = 0;
+    int i;
+
+    put(o, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    for (i = 0; i < NBUCKETS; i++) {
+	cum += LOAD(h->counts[i]);
+	put(o, "%s_bucket{le=\"%g\"} %lu\n", name, h->bounds[i] / 1e9, cum);
+    }
+    cum += LOAD(h->counts[NBUCKETS]);
+    put(o, "%s_bucket{le=\"+Inf\"} %lu\n", name, cum);
+    put(o, "%s_sum %.9f\n%s_count %lu\n", name, LOAD(h->sum) / 1e9, name, LOAD(h->count));
+}
+
+/* metrics_format - Render every metric into a malloc'd *buf; returns its length */
+int metrics_format(char **buf)
+{
+    struct out_t o = { NULL, 0, 0 };
+    struct limit_stats ls;
+    int fg = 0, bg = 0, st = 0, i;
+
+    o.cap = 4096;
+    if ((o.buf = (char *)malloc(o.cap)) == NULL)
+	unix_error("metrics: malloc error");
+    for (i = 0; i < MAXJOBS; i++) {
+	fg += jobs[i].state == FG;
+	bg += jobs[i].state == BG;
+	st += jobs[i].state == ST;
+    }
+
+    counter(&o, "tsh_jobs_started_total", "Jobs started.", LOAD(started));
+    counter(&o, "tsh_jobs_reaped_total", "Jobs that exited or were killed.", LOAD(reaped));
+    counter(&o, "tsh_jobs_stopped_total", "Times a job was stopped.", LOAD(stopped));
+    counter(&o, "tsh_jobs_killed_total", "Jobs terminated by a signal.", LOAD(killed));
+    counter(&o, "tsh_orphans_reaped_total", "Orphaned descendants of jobs reaped (tsh -r).",
+	    LOAD(orphans));
+    put(&o, "# HELP tsh_jobs Jobs in the job table by state.\n# TYPE tsh_jobs gauge\n");
+    put(&o, "tsh_jobs{state=\"foreground\"} %d\n", fg);
+    put(&o, "tsh_jobs{state=\"running\"} %d\n", bg);
+    put(&o, "tsh_jobs{state=\"stopped\"} %d\n", st);
+    put(&o, "# HELP tsh_queue_depth Requests waiting in the shell.\n"
+	"# TYPE tsh_queue_depth gauge\ntsh_queue_depth %d\n", ctl_pending());
+    limit_counters(&ls);
+    counter(&o, "tsh_spawns_delayed_total", "Launches held back by the spawn limits.", ls.delayed);
+    counter(&o, "tsh_spawns_interrupted_total", "Held-back launches abandoned at ctrl-c.",
+	    ls.interrupted);
+    put(&o, "# HELP tsh_spawn_delay_seconds_total Time launches spent held back.\n"
+	"# TYPE tsh_spawn_delay_seconds_total counter\ntsh_spawn_delay_seconds_total %.9f\n",
+	ls.waited / 1e9);
+    put(&o, "# HELP tsh_children Children alive (running or stopped).\n"
+	"# TYPE tsh_children gauge\ntsh_children %d\n", ls.live);
+    histogram(&o, "tsh_spawn_latency_seconds", "Time to fork a job and enter it in the job table.",
+	      &spawn_hist);
+    histogram(&o, "tsh_reap_delay_seconds", "Time from entering the SIGCHLD handler to reaping the child.",
+	      &reap_hist);
+    *buf = o.buf;
+    return o.len;
+}
+
+/*
+ * Periodic textfile output
+ */
+
+/* metrics_setfile - Write the metrics to path every METRICS_INTERVAL seconds */
+void metrics_setfile(const char *path)
+{
+    free(textfile);
+    textfile = path ? strdup(path) : NULL;
+    nextwrite = 0;
+}
+
+/* metrics_due - Milliseconds until the next write, -1 if none is scheduled */
+int metrics_due(void)
+{
+    long long left;
+
+    if (textfile == NULL)
+	return -1;
+    left = nextwrite - timer_now();
+    return left > 0 ? (int)((left + 999999) / 1000000) : 0;
+}
+
+/* metrics_tick - Write the textfile if it is due (atomically, via rename) */
+void metrics_tick(void)
+{
+    char tmp[4096], *buf;
+    int fd, len;
+
+    if (textfile == NULL || timer_now() < nextwrite)
+	return;
+    nextwrite = timer_now() + METRICS_INTERVAL * 1000000000LL;
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", textfile, (int)getpid());
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+	return;
+    len = metrics_format(&buf);
+    if (write(fd, buf, len) != len) {
+	close(fd);
+	unlink(tmp);
+    }
+    else if (close(fd) == 0)
+	rename(tmp, textfile);
+    else
+	unlink(tmp);                /* fd is gone either way; don't close it twice */
+    free(buf);
+}
+/*****************************
+ * end shell metrics
+ *****************************/
@@ -0,0 +1,23 @@
+//-*-c++-*-
+#ifndef _metrics_h_
+#define _metrics_h_
+
+/*
+ * Shell and job counters, exported in the Prometheus text format.
+ * The update calls are relaxed atomic adds, safe from the signal
+ * handlers and cheap enough for the launch and reap paths.
+ */
+
+#define METRICS_INTERVAL 15     /* seconds between textfile writes */
+
+void metrics_spawned(long long ns);
+void metrics_reaped(int signaled, long long ns);
+void metrics_stopped(void);
+void metrics_orphaned(void);
+
+int metrics_format(char **buf);
+void metrics_setfile(const char *path);
+int metrics_due(void);
+void metrics_tick(void);
+
+#endif
@@ -0,0 +1,49 @@
+/* 
+ * mybuiltins.c - Example loadable builtins for your tiny shell
+ * 
+ * usage: enable -f ./mybuiltins.so echo myusleep
+ * echo prints its arguments; myusleep <usecs> sleeps without a fork,
+ * so a script can pace itself at a fraction of the cost of the
+ * ./myusleep helper.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+#include "tshbuiltin.h"
+
+static int echo_main(int argc, char **argv)
+{
+    int i;
+
+    for (i = 1; i < argc; i++)
+	printf(i < argc - 1 ? "%s " : "%s", argv[i]);
+    printf("\n");
+    return 0;
+}
+
+static int myusleep_main(int argc, char **argv)
+{
+    struct timespec ts;
+    long usecs;
+
+    if (argc != 2) {
+	printf("Usage: %s <usecs>\n", argv[0]);
+	return 2;
+    }
+    usecs = atol(argv[1]);
+    ts.tv_sec = usecs / 1000000;
+    ts.tv_nsec = usecs % 1000000 * 1000;
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)  /* child events */
+	;
+    return 0;
+}
+
+extern "C" {
+struct tsh_builtin echo_builtin = {
+    TSH_BUILTIN_ABI, "echo", echo_main, "echo [args]"
+};
+struct tsh_builtin myusleep_builtin = {
+    TSH_BUILTIN_ABI, "myusleep", myusleep_main, "myusleep <usecs>"
+};
+}
@@ -0,0 +1,44 @@
+/* 
+ * mytree.c - A process tree for stress testing your tiny shell
+ * 
+ * usage: mytree <depth> <fanout> [<usecs>]
+ * Fork a tree <depth> levels deep in which every inner process has
+ * <fanout> children and waits for them; the leaves sleep <usecs>
+ * microseconds. The whole tree stays in the job's process group.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+
+int main(int argc, char **argv) 
+{
+    int i, depth, fanout;
+    long usecs;
+
+    if (argc != 3 && argc != 4) {
+	fprintf(stderr, "Usage: %s <depth> <fanout> [<usecs>]\n", argv[0]);
+	exit(0);
+    }
+    depth = atoi(argv[1]);
+    fanout = atoi(argv[2]);
+    usecs = argc == 4 ? atol(argv[3]) : 0;
+
+    while (depth-- > 0) {
+	for (i = 0; i < fanout; i++)
+	    if (fork() == 0)    /* child: becomes the root of a subtree */
+		break;
+	if (i == fanout) {      /* parent waits for its children */
+	    while (wait(NULL) > 0)
+		;
+	    exit(0);
+	}
+    }
+
+    /* leaf */
+    if (usecs > 0)
+	usleep(usecs);
+    exit(0);
+}
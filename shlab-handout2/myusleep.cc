@@ -0,0 +1,37 @@
+/* 
+ * myusleep.c - A short-lived child for stress testing your tiny shell
+ * 
+ * usage: myusleep <usecs> [<align>]
+ * Sleeps for <usecs> microseconds and exits. With <align>, it then
+ * sleeps on to the next multiple of <align> microseconds of wall-clock
+ * time, so children started close together all exit in one burst.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/time.h>
+
+int main(int argc, char **argv) 
+{
+    long usecs, align;
+    struct timeval tv;
+    struct timespec ts;
+
+    if (argc != 2 && argc != 3) {
+	fprintf(stderr, "Usage: %s <usecs> [<align>]\n", argv[0]);
+	exit(0);
+    }
+    usecs = atol(argv[1]);
+    align = argc == 3 ? atol(argv[2]) : 0;
+
+    if (align > 0) {
+	gettimeofday(&tv, NULL);
+	usecs += align - (tv.tv_sec % align * 1000000 + tv.tv_usec + usecs) % align;
+    }
+    ts.tv_sec = usecs / 1000000;
+    ts.tv_nsec = usecs % 1000000 * 1000;
+    while (nanosleep(&ts, &ts) < 0)
+	;
+    exit(0);
+}
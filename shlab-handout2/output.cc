@@ -0,0 +1,291 @@
+#include "output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+/*****************************************************
+ * Shell output buffer
+ *
+ * Two buffers: the main program flips between them on a flush, so
+ * a handler that runs while one is being written appends to the
+ * other. Space is reserved with a compare-and-swap, so a handler that
+ * interrupts the main program halfway through an append lands after
+ * it instead of on top of it.
+ *****************************************************/
+
+static char bufs[2][OUTBUF];
+static int lens[2];
+static volatile int cur = 0;            /* buffer being filled */
+static struct outcap *capture = NULL;   /* open capture, if any */
+volatile int out_inhandler = 0;
+
+#define SAFEF_IOV 7     /* pieces of an out_safef line: up to three %s strings */
+
+/* reserve - Claim n bytes in the current buffer; NULL if they don't fit */
+static char *reserve(int n)
+{
+    int b = cur, len;
+
+    len = __atomic_load_n(&lens[b], __ATOMIC_RELAXED);
+    do {
+	if (len + n > OUTBUF)
+	    return NULL;
+    } while (!__atomic_compare_exchange_n(&lens[b], &len, len + n, 1,
+					  __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return bufs[b] + len;
+}
+
+/* writeall - write(2) until all of buf is out */
+static void writeall(const char *buf, int len)
+{
+    int n;
+
+    while (len > 0) {
+	if ((n = write(STDOUT_FILENO, buf, len)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return;
+	}
+	buf += n;
+	len -= n;
+    }
+}
+
+/*
+ * out_fmtint - Decimal digits of v into buf (at least 21 bytes, not
+ *    terminated); returns their number. Two digits per division.
+ */
+int out_fmtint(char *buf, long v)
+{
+    static const char pairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+    char tmp[24], *p = tmp + sizeof(tmp);
+    unsigned long u = v < 0 ? -(unsigned long)v : v;
+    int n;
+
+    while (u >= 100) {
+	p -= 2;
+	memcpy(p, pairs + 2 * (u % 100), 2);
+	u /= 100;
+    }
+    if (u >= 10) {
+	p -= 2;
+	memcpy(p, pairs + 2 * u, 2);
+    }
+    else
+	*--p = '0' + u;
+    if (v < 0)
+	*--p = '-';
+    n = tmp + sizeof(tmp) - p;
+    memcpy(buf, p, n);
+    return n;
+}
+
+/*
+ * out_safef - Async-signal-safe printf for %d, %ld, %s, %c and %%.
+ *    The line is formatted on the stack, except that %s strings (job
+ *    command lines, of any length) are left where they are and only
+ *    pointed at, and all of it is appended in one piece; it never
+ *    flushes, and is written directly if the buffer is full. From the
+ *    main program it goes to an open capture like out_put.
+ */
+void out_safef(const char *fmt, ...)
+{
+    char line[512], *p, *seg = line;
+    struct iovec iov[SAFEF_IOV];
+    const char *s;
+    va_list ap;
+    int n = 0, k, i, niov = 0, total = 0;
+
+    va_start(ap, fmt);
+    for (; *fmt && n < (int)sizeof(line) - 24; fmt++) {
+	if (*fmt != '%') {
+	    line[n++] = *fmt;
+	    continue;
+	}
+	switch (*++fmt) {
+	case 'd':
+	    n += out_fmtint(line + n, va_arg(ap, int));
+	    break;
+	case 'l':
+	    fmt++;
+	    n += out_fmtint(line + n, va_arg(ap, long));
+	    break;
+	case 's':
+	    s = va_arg(ap, const char *);
+	    if (niov + 3 <= SAFEF_IOV) {
+		iov[niov].iov_base = seg;
+		iov[niov++].iov_len = line + n - seg;
+		iov[niov].iov_base = (void *)s;
+		iov[niov++].iov_len = strlen(s);
+		seg = line + n;
+		break;
+	    }
+	    k = strlen(s);              /* out of pieces: copy what fits */
+	    if (k > (int)sizeof(line) - 24 - n)
+		k = sizeof(line) - 24 - n;
+	    memcpy(line + n, s, k);
+	    n += k;
+	    break;
+	case 'c':
+	    line[n++] = va_arg(ap, int);
+	    break;
+	case '\0':
+	    fmt--;
+	    break;
+	default:
+	    line[n++] = *fmt;
+	}
+    }
+    va_end(ap);
+    iov[niov].iov_base = seg;
+    iov[niov++].iov_len = line + n - seg;
+
+    for (i = 0; i < niov; i++)
+	total += iov[i].iov_len;
+    if (capture != NULL && out_inhandler == 0) {
+	for (i = 0; i < niov; i++)
+	    out_put((const char *)iov[i].iov_base, iov[i].iov_len);
+	return;
+    }
+    if ((p = reserve(total)) != NULL)
+	for (i = 0; i < niov; p += iov[i].iov_len, i++)
+	    memcpy(p, iov[i].iov_base, iov[i].iov_len);
+    else
+	for (i = 0; i < niov; i++)
+	    writeall((const char *)iov[i].iov_base, iov[i].iov_len);
+}
+
+/* out_put - Append len bytes of s, flushing first if they don't fit */
+void out_put(const char *s, int len)
+{
+    char *p;
+
+    if (capture != NULL) {
+	out_grow(capture, capture->len + len);
+	memcpy(capture->buf + capture->len, s, len);
+	capture->len += len;
+	return;
+    }
+
+    if ((p = reserve(len)) == NULL) {
+	out_flush();
+	if (len > OUTBUF / 2 || (p = reserve(len)) == NULL) {
+	    writeall(s, len);
+	    return;
+	}
+    }
+    memcpy(p, s, len);
+}
+
+/* out_printf - printf into the buffer (not async-signal-safe) */
+void out_printf(const char *fmt, ...)
+{
+    char line[1024], *big;
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (n < (int)sizeof(line)) {
+	out_put(line, n);
+	return;
+    }
+    if ((big = (char *)malloc(n + 1)) == NULL)
+	return;
+    va_start(ap, fmt);
+    vsnprintf(big, n + 1, fmt, ap);
+    va_end(ap);
+    out_put(big, n);
+    free(big);
+}
+
+/*
+ * out_prompt - Write out the buffered output followed by prompt (if
+ *    not NULL) with one writev. No system call if both are empty.
+ */
+void out_prompt(const char *prompt)
+{
+    struct iovec iov[2];
+    int b = cur, n = 0, total, done;
+
+    cur = !b;                   /* handlers from here on use the other buffer */
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    if (lens[b] > 0) {
+	iov[n].iov_base = bufs[b];
+	iov[n++].iov_len = lens[b];
+    }
+    if (prompt != NULL && *prompt) {
+	iov[n].iov_base = (void *)prompt;
+	iov[n++].iov_len = strlen(prompt);
+    }
+    for (total = 0, done = 0; done < n; done++)
+	total += iov[done].iov_len;
+
+    for (done = 0; n > 0 && total > 0; ) {
+	if ((done = writev(STDOUT_FILENO, iov, n)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+	total -= done;
+	while (n > 0 && done >= (int)iov[0].iov_len) {   /* short write */
+	    done -= iov[0].iov_len;
+	    iov[0] = iov[1];
+	    n--;
+	}
+	if (n > 0) {
+	    iov[0].iov_base = (char *)iov[0].iov_base + done;
+	    iov[0].iov_len -= done;
+	}
+    }
+    lens[b] = 0;
+}
+
+/* out_flush - Write out everything buffered so far */
+void out_flush(void)
+{
+    out_prompt(NULL);
+}
+
+/* out_discard - Drop the buffered output and capture (a forked child's copy) */
+void out_discard(void)
+{
+    lens[0] = lens[1] = 0;
+    capture = NULL;
+}
+
+/* out_grow - Make room for need bytes (and a terminator) in c */
+void out_grow(struct outcap *c, int need)
+{
+    if (need + 1 <= c->cap)
+	return;
+    c->cap = need + 1 > 2 * c->cap ? need + 1 : 2 * c->cap;
+    if ((c->buf = (char *)realloc(c->buf, c->cap)) == NULL) {
+	writeall("out_grow: realloc error\n", 24);
+	exit(1);
+    }
+}
+
+/* out_capture - Collect the main program's output in c from now on */
+void out_capture(struct outcap *c)
+{
+    c->prev = capture;
+    capture = c;
+}
+
+/* out_endcapture - Close capture c; output goes where it went before */
+void out_endcapture(struct outcap *c)
+{
+    capture = c->prev;
+}
+/*****************************
+ * end shell output
+ *****************************/
@@ -0,0 +1,42 @@
+//-*-c++-*-
+#ifndef _output_h_
+#define _output_h_
+
+/*
+ * Buffered shell output. Everything the shell prints, from the main
+ * program and from the signal handlers alike, lands in one buffer in
+ * the order it was produced and goes out in a single writev when the
+ * shell is about to block, usually together with the next prompt.
+ *
+ * out_safef and out_fmtint are async-signal-safe; out_put, out_printf
+ * and the flushes are for the main program only, as are captures.
+ */
+
+#define OUTBUF 16384    /* bytes buffered before a forced flush */
+
+/*
+ * While a capture is open, out_put, out_printf and out_safef append to
+ * it instead (for $(builtin)), except for what the signal handlers
+ * print: a handler that prints raises out_inhandler for its duration,
+ * and its lines go to the shell's output as usual. Captures nest.
+ */
+struct outcap {
+    char *buf;              /* malloc'd, grows as needed */
+    int len, cap;
+    struct outcap *prev;    /* the capture this one interrupted */
+};
+
+extern volatile int out_inhandler;   /* >0 while a signal handler runs */
+
+int out_fmtint(char *buf, long v);
+void out_safef(const char *fmt, ...);
+void out_put(const char *s, int len);
+void out_printf(const char *fmt, ...);
+void out_flush(void);
+void out_prompt(const char *prompt);
+void out_discard(void);
+void out_capture(struct outcap *c);
+void out_endcapture(struct outcap *c);
+void out_grow(struct outcap *c, int need);
+
+#endif
@@ -0,0 +1,230 @@
+#include "parsecache.h"
+#include "builtin.h"
+#include "helper-routines.h"
+#include "env.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/******************************************************
+ * Parsed-command cache: an LRU of parseline() results
+ * keyed by the raw command line bytes.
+ ******************************************************/
+
+static struct pcmd_t cache[PCACHE_SIZE];
+static int buckets[PCACHE_BUCKETS];     /* head of each chain, -1 if empty */
+static int lru_head = -1;               /* most recently used entry */
+static int lru_tail = -1;               /* least recently used entry */
+static int nentries = 0;                /* slots handed out so far */
+static int initialized = 0;
+static unsigned long hits = 0, misses = 0;
+
+/* pc_hash - 64-bit FNV-1a over len bytes of s */
+unsigned long pc_hash(const char *s, int len)
+{
+    unsigned long h = 1469598103934665603UL;
+    int i;
+
+    for (i = 0; i < len; i++) {
+	h ^= (unsigned char)s[i];
+	h *= 1099511628211UL;
+    }
+    return h;
+}
+
+/* pc_init - Empty every hash bucket */
+static void pc_init(void)
+{
+    int i;
+
+    for (i = 0; i < PCACHE_BUCKETS; i++)
+	buckets[i] = -1;
+    initialized = 1;
+}
+
+/* lru_unlink - Take entry i off the LRU list */
+static void lru_unlink(int i)
+{
+    if (cache[i].prev >= 0)
+	cache[cache[i].prev].next = cache[i].next;
+    else
+	lru_head = cache[i].next;
+    if (cache[i].next >= 0)
+	cache[cache[i].next].prev = cache[i].prev;
+    else
+	lru_tail = cache[i].prev;
+}
+
+/* lru_push - Make entry i the most recently used */
+static void lru_push(int i)
+{
+    cache[i].prev = -1;
+    cache[i].next = lru_head;
+    if (lru_head >= 0)
+	cache[lru_head].prev = i;
+    lru_head = i;
+    if (lru_tail < 0)
+	lru_tail = i;
+}
+
+/* chain_unlink - Remove entry i from its hash bucket */
+static void chain_unlink(int i)
+{
+    int *p = &buckets[cache[i].hash & (PCACHE_BUCKETS-1)];
+
+    while (*p >= 0) {
+	if (*p == i) {
+	    *p = cache[i].chain;
+	    return;
+	}
+	p = &cache[*p].chain;
+    }
+}
+
+/*
+ * pc_reserve - Make room in cmd for a len-byte line. A line of len
+ *    bytes has at most len/2 + 1 words, so argv is sized from it.
+ */
+static void pc_reserve(struct pcmd_t *cmd, int len)
+{
+    if (len + 1 <= cmd->cap)
+	return;
+    cmd->cap = len + 1 > MAXLINE ? len + 1 : MAXLINE;
+    free(cmd->line);
+    free(cmd->buf);
+    free(cmd->argv);
+    if ((cmd->line = (char *)malloc(cmd->cap)) == NULL ||
+	(cmd->buf = (char *)malloc(cmd->cap)) == NULL ||
+	(cmd->argv = (char **)malloc((cmd->cap / 2 + 1) * sizeof(char *))) == NULL)
+	unix_error("pc_reserve: malloc error");
+}
+
+/* pc_parse - Fill in cmd from its raw line */
+static void pc_parse(struct pcmd_t *cmd)
+{
+    cmd->bg = parseline(cmd->line, cmd->buf, cmd->argv);
+    for (cmd->argc = 0; cmd->argv[cmd->argc] != NULL; cmd->argc++)
+	;
+    for (cmd->nassign = 0; cmd->nassign < cmd->argc; cmd->nassign++)
+	if (!env_assignment(cmd->argv[cmd->nassign]))
+	    break;
+    cmd->builtin = cmd->nassign < cmd->argc ?
+	builtin_lookup(cmd->argv[cmd->nassign]) : -1;
+    cmd->gen = builtin_gen;
+}
+
+/* pc_victim - Pick a free or least recently used unpinned slot, -1 if none */
+static int pc_victim(void)
+{
+    int i;
+
+    if (nentries < PCACHE_SIZE)
+	return nentries++;
+    for (i = lru_tail; i >= 0; i = cache[i].prev)
+	if (cache[i].refs == 0) {
+	    lru_unlink(i);
+	    chain_unlink(i);
+	    return i;
+	}
+    return -1;
+}
+
+/*
+ * pc_lookup - Return the parsed form of cmdline, parsing it only on a
+ *    miss. The returned entry is pinned until pc_release().
+ */
+struct pcmd_t *pc_lookup(const char *cmdline)
+{
+    struct pcmd_t *cmd;
+    int len = strlen(cmdline);
+    unsigned long h = pc_hash(cmdline, len);
+    int i;
+
+    if (!initialized)
+	pc_init();
+
+    for (i = buckets[h & (PCACHE_BUCKETS-1)]; i >= 0; i = cache[i].chain) {
+	if (cache[i].hash == h && cache[i].len == len &&
+	    memcmp(cache[i].line, cmdline, len) == 0) {
+	    if (cache[i].prefetched)    /* the parse it would have missed */
+		misses++;
+	    else
+		hits++;
+	    cache[i].prefetched = 0;
+	    lru_unlink(i);
+	    lru_push(i);
+	    cache[i].refs++;
+	    if (cache[i].gen != builtin_gen) {  /* enable changed the builtins */
+		cache[i].builtin = cache[i].nassign < cache[i].argc ?
+		    builtin_lookup(cache[i].argv[cache[i].nassign]) : -1;
+		cache[i].gen = builtin_gen;
+	    }
+	    return &cache[i];
+	}
+    }
+
+    misses++;
+    if ((i = pc_victim()) < 0) {
+	/* every slot is pinned: parse into a private entry */
+	if ((cmd = (struct pcmd_t *)calloc(1, sizeof(struct pcmd_t))) == NULL)
+	    unix_error("pc_lookup: malloc error");
+	cmd->transient = 1;
+    }
+    else {
+	cmd = &cache[i];
+	cmd->transient = 0;
+	cmd->chain = buckets[h & (PCACHE_BUCKETS-1)];
+	buckets[h & (PCACHE_BUCKETS-1)] = i;
+	lru_push(i);
+    }
+    cmd->hash = h;
+    cmd->len = len;
+    pc_reserve(cmd, len);
+    memcpy(cmd->line, cmdline, len+1);
+    pc_parse(cmd);
+    cmd->refs = 1;
+    cmd->prefetched = 0;
+    return cmd;
+}
+
+/* pc_release - Unpin an entry returned by pc_lookup */
+void pc_release(struct pcmd_t *cmd)
+{
+    if (cmd->transient) {
+	free(cmd->line);
+	free(cmd->buf);
+	free(cmd->argv);
+	free(cmd);
+    }
+    else
+	cmd->refs--;
+}
+
+/*
+ * pc_prefetch - Parse cmdline into the cache ahead of its lookup. It
+ *    is not counted as a hit or a miss, and a line it parsed counts as
+ *    a miss when it is first looked up, so the stats still describe
+ *    the lines the shell actually ran.
+ */
+void pc_prefetch(const char *cmdline)
+{
+    unsigned long h = hits, m = misses;
+    struct pcmd_t *cmd = pc_lookup(cmdline);
+
+    if (misses != m)
+	cmd->prefetched = 1;
+    pc_release(cmd);
+    hits = h;
+    misses = m;
+}
+
+/* pc_stats - Report the hit/miss counters and the number of entries */
+void pc_stats(unsigned long *h, unsigned long *m, int *entries)
+{
+    *h = hits;
+    *m = misses;
+    *entries = nentries;
+}
+/******************************
+ * end parsed-command cache
+ ******************************/
@@ -0,0 +1,41 @@
+//-*-c++-*-
+#ifndef _parsecache_h_
+#define _parsecache_h_
+
+#include "globals.h"
+
+#define PCACHE_SIZE     64   /* parsed command lines kept in the cache */
+#define PCACHE_BUCKETS 128   /* hash buckets (power of two) */
+
+/*
+ * A fully parsed command line, of any length: an entry's buffers grow
+ * to fit the longest line it has held. Entries are owned by the cache
+ * and handed out pinned: the caller must pc_release() them when done so
+ * that an entry in use is never evicted underneath it.
+ */
+struct pcmd_t {
+    unsigned long hash;         /* FNV-1a hash of the raw line */
+    int len;                    /* length of the raw line */
+    char *line;                 /* raw command line (the cache key) */
+    char *buf;                  /* tokenized copy that argv points into */
+    char **argv;                /* argument vector, NULL terminated */
+    int cap;                    /* bytes in line and buf; argv holds cap/2+1 */
+    int argc;                   /* number of arguments */
+    int nassign;                /* leading NAME=value words */
+    int bg;                     /* run in the background? */
+    int builtin;                /* builtin table index, -1 if external */
+    int gen;                    /* builtin_gen when builtin was resolved */
+    int refs;                   /* pin count */
+    int transient;              /* not in the cache, free on release */
+    int prefetched;             /* parsed by pc_prefetch, not yet looked up */
+    int next, prev;             /* LRU list links (indices) */
+    int chain;                  /* hash bucket chain (index) */
+};
+
+struct pcmd_t *pc_lookup(const char *cmdline);
+void pc_release(struct pcmd_t *cmd);
+void pc_prefetch(const char *cmdline);
+void pc_stats(unsigned long *hits, unsigned long *misses, int *entries);
+unsigned long pc_hash(const char *s, int len);
+
+#endif
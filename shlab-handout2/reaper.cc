@@ -0,0 +1,61 @@
+#include "reaper.h"
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <errno.h>
+#include <string.h>
+
+/*********************************
+ * Child-subreaper mode
+ *********************************/
+
+int reaper_on = 0;
+
+/* reaper_init - Become the subreaper of our descendants; 0 on success */
+int reaper_init(void)
+{
+    if (prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0) < 0)
+	return -1;
+    reaper_on = 1;
+    return 0;
+}
+
+/*
+ * reaper_next - Reap the next child that exited, was killed or
+ *    stopped, like waitpid(-1, status, WNOHANG|WUNTRACED), and set
+ *    *pgid to the process group it was in. Returns its pid, or 0 if
+ *    there is none. Off subreaper mode every child is a job leader, so
+ *    its pid is its group; on it, the child is looked at first with
+ *    WNOWAIT, while its process group can still be asked for.
+ */
+pid_t reaper_next(int *status, pid_t *pgid)
+{
+    siginfo_t info;
+    pid_t pid;
+
+    if (!reaper_on) {
+	pid = waitpid(-1, status, WNOHANG | WUNTRACED);
+	*pgid = pid;
+	return pid > 0 ? pid : 0;
+    }
+    memset(&info, 0, sizeof(info));
+    if (waitid(P_ALL, 0, &info, WEXITED | WSTOPPED | WNOHANG | WNOWAIT) < 0 ||
+	info.si_pid == 0)
+	return 0;
+    *pgid = getpgid(info.si_pid);
+    pid = waitpid(info.si_pid, status, WNOHANG | WUNTRACED);
+    return pid > 0 ? pid : 0;
+}
+
+/* reaper_groupgone - Has every process in group pgid been reaped? */
+int reaper_groupgone(pid_t pgid)
+{
+    int olderrno = errno, gone;
+
+    gone = kill(-pgid, 0) < 0 && errno == ESRCH;
+    errno = olderrno;
+    return gone;
+}
+/*****************************
+ * end child-subreaper mode
+ *****************************/
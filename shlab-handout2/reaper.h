@@ -0,0 +1,23 @@
+//-*-c++-*-
+#ifndef _reaper_h_
+#define _reaper_h_
+
+#include <sys/types.h>
+
+/*
+ * Child-subreaper mode (tsh -r). The shell marks itself with
+ * PR_SET_CHILD_SUBREAPER, so a job's descendants that outlive their
+ * parent are reparented to the shell instead of init, and
+ * sigchld_handler reaps them along with its own children. Each is
+ * attributed to its job by process group: a job's group is named
+ * after its leader, whose pid the job table keeps. A job whose leader
+ * has exited stays in the table until the last of its group is gone.
+ */
+
+extern int reaper_on;
+
+int reaper_init(void);
+pid_t reaper_next(int *status, pid_t *pgid);
+int reaper_groupgone(pid_t pgid);
+
+#endif
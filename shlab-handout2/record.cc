@@ -0,0 +1,120 @@
+#include "record.h"
+#include "timer.h"
+#include "output.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+
+/*****************************
+ * Session recording
+ *****************************/
+
+static int recfd = -1;
+static long long t0;            /* timer_now() when recording began */
+
+/* putvarint - Append v to buf as LEB128, return the bytes used */
+static int putvarint(unsigned char *buf, unsigned long long v)
+{
+    int n = 0;
+
+    do {
+	buf[n] = v & 0x7f;
+	v >>= 7;
+	buf[n++] |= v ? 0x80 : 0;
+    } while (v);
+    return n;
+}
+
+/* head - Start a record of the given type at buf, return its length */
+static int head(unsigned char *buf, int type)
+{
+    buf[0] = type;
+    return 1 + putvarint(buf + 1, (timer_now() - t0) / 1000);
+}
+
+/*
+ * rec_open - Start a log in path (replacing it). Returns 0, or -1
+ *    after printing why not.
+ */
+int rec_open(const char *path)
+{
+    if ((recfd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644)) < 0 ||
+	write(recfd, REC_MAGIC, strlen(REC_MAGIC)) < 0) {
+	out_printf("record: %s: %s\n", path, strerror(errno));
+	if (recfd >= 0)
+	    close(recfd);
+	recfd = -1;
+	return -1;
+    }
+    t0 = timer_now();
+    return 0;
+}
+
+void rec_line(const char *line)
+{
+    unsigned char buf[32];
+    struct iovec iov[2];
+    int len = strlen(line), n;
+
+    if (recfd < 0)
+	return;
+    n = head(buf, 'L');
+    n += putvarint(buf + n, len);
+    iov[0].iov_base = buf;
+    iov[0].iov_len = n;
+    iov[1].iov_base = (void *)line;
+    iov[1].iov_len = len;
+    writev(recfd, iov, 2);
+}
+
+/* rec_signal - Log a signal to the shell; async-signal-safe */
+void rec_signal(int sig)
+{
+    unsigned char buf[16];
+    int n, olderrno = errno;
+
+    if (recfd < 0)
+	return;
+    n = head(buf, 'S');
+    buf[n++] = sig;
+    write(recfd, buf, n);
+    errno = olderrno;
+}
+
+/* rec_child - Log a child event; async-signal-safe */
+void rec_child(int jid, int kind, int code)
+{
+    unsigned char buf[32];
+    int n, olderrno = errno;
+
+    if (recfd < 0)
+	return;
+    n = head(buf, 'C');
+    n += putvarint(buf + n, jid);
+    buf[n++] = kind;
+    buf[n++] = code;
+    write(recfd, buf, n);
+    errno = olderrno;
+}
+
+/* rec_detach - Close our copy of the log, which is the shell's (a subshell's) */
+void rec_detach(void)
+{
+    if (recfd >= 0)
+	close(recfd);
+    recfd = -1;
+}
+
+void rec_eof(void)
+{
+    unsigned char buf[16];
+
+    if (recfd < 0)
+	return;
+    write(recfd, buf, head(buf, 'E'));
+}
+/*****************************
+ * end session recording
+ *****************************/
@@ -0,0 +1,33 @@
+//-*-c++-*-
+#ifndef _record_h_
+#define _record_h_
+
+/*
+ * Session recording for replay.pl. With -R the shell logs its input
+ * lines, the signals it receives and its children's exits and stops,
+ * each with the time since recording began, so that a real session
+ * can be rerun later as a benchmark.
+ *
+ * The log starts with the 8 bytes "TSHREC1\n". Every record is a type
+ * byte and the time in microseconds as a LEB128 varint, then
+ *
+ *   'L'  varint length, the line (newline included)
+ *   'S'  signal number byte
+ *   'C'  varint jid, kind byte ('x' exited, 'k' killed, 'z' stopped),
+ *        exit status or signal number byte
+ *   'E'  nothing: end of input
+ *
+ * Each record goes out in a single write, so the signal handlers can
+ * log too.
+ */
+
+#define REC_MAGIC "TSHREC1\n"
+
+int rec_open(const char *path);
+void rec_line(const char *line);
+void rec_signal(int sig);
+void rec_child(int jid, int kind, int code);
+void rec_eof(void);
+void rec_detach(void);
+
+#endif
@@ -0,0 +1,198 @@
+#!/usr/bin/perl
+use Getopt::Std;
+use FileHandle;
+use IPC::Open2;
+use POSIX ":sys_wait_h";
+use Time::HiRes qw(time sleep);
+
+#######################################################################
+# replay.pl - Rerun a session recorded with tsh -R
+#
+# Runs a shell (tsh, or tshref) as a child with its stdin and stdout on
+# pipes and feeds it the recorded input lines and signals, printing
+# whatever it writes. The gap before each line or signal is the
+# recorded one divided by the speed; with -f the gaps before input
+# lines (the user's think time) are dropped altogether, while the gap
+# from a line to a signal is kept, so that a ctrl-c still lands on
+# the job it hit when recorded.
+#
+# Lines are only sent once the shell has printed its prompt, so a job
+# that reads stdin can never swallow them; run the shell with its
+# prompt on (that is, without -p).
+#
+# At the end it reports the recorded and replayed durations, which
+# makes any recorded session a repeatable benchmark.
+#
+######################################################################
+
+#
+# usage - print help message and terminate
+#
+sub usage
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-hf] -r <log> [-s <shell>] [-a <args>] [-x <speed>]\n";
+    printf STDERR "Options:\n";
+    printf STDERR "  -h            Print this message\n";
+    printf STDERR "  -r <log>      Session log written by tsh -R\n";
+    printf STDERR "  -s <shell>    Shell program to run (default ./tsh)\n";
+    printf STDERR "  -a <args>     Shell arguments\n";
+    printf STDERR "  -x <speed>    Speed-up factor (default 1)\n";
+    printf STDERR "  -f            Skip the think time before each input line\n";
+    die "\n" ;
+}
+
+# Parse the command line arguments
+getopts('hfr:s:a:x:');
+if ($opt_h) {
+    usage();
+}
+$opt_r or usage("Missing required -r argument");
+$shellprog = $opt_s ? $opt_s : "./tsh";
+$speed = $opt_x ? $opt_x : 1;
+$speed > 0 or usage("Speed must be positive");
+
+-x $shellprog
+    or die "$0: ERROR: $shellprog not found or not executable\n";
+@recs = readlog($opt_r);
+
+# Fork the shell with pipes on its stdin and stdout
+$pid = open2(\*Reader, \*Writer, "$shellprog $opt_a");
+Writer->autoflush(1);
+$ready = 0;
+$eof = 0;
+
+%signame = (2 => "INT", 3 => "QUIT", 20 => "TSTP");
+($nlines, $nsignals, $nchild) = (0, 0, 0);
+$start = time;
+$prevat = $start;   # when the previous line or signal was replayed
+$prevt = 0;         # and when it was recorded
+
+foreach $rec (@recs) {
+    ($type, $t, $data) = @$rec;
+    $due = $prevat + ($t - $prevt) / 1e6 / $speed;
+    if ($type eq "L") {
+	$due = time if ($opt_f);
+	pump($due);
+	pump(time + 30, 1) until ($ready || $eof);
+	last if ($eof);
+	print Writer $data;
+	$ready = 0;
+	$nlines++;
+    }
+    elsif ($type eq "S") {
+	pump($due);
+	kill($signame{$data} ? $signame{$data} : $data, $pid);
+	$nsignals++;
+    }
+    elsif ($type eq "C") {
+	$nchild++;
+	next;
+    }
+    elsif ($type eq "E") {
+	pump($due);
+	close Writer;
+    }
+    $prevat = time;
+    $prevt = $t;
+}
+
+# Let the shell finish and print the rest of its output
+close Writer;
+pump(time + 30) until ($eof);
+waitpid($pid, 0);
+$elapsed = time - $start;
+$recorded = @recs ? $recs[-1][1] / 1e6 : 0;
+printf STDERR "%s: %d lines, %d signals, %d child events; recorded %.3fs, replayed %.3fs (%.1fx)\n",
+    $0, $nlines, $nsignals, $nchild, $recorded, $elapsed,
+    $elapsed > 0 ? $recorded / $elapsed : 0;
+exit(0);
+
+#
+# readlog - Decode a session log into a list of [type, usecs, data]
+#
+sub readlog
+{
+    my ($path) = @_;
+    my ($buf, $pos, $type, $t, $len, @out);
+
+    open(LOG, "<", $path)
+	or die "$0: ERROR: Couldn't open $path: $!\n";
+    binmode(LOG);
+    local $/;
+    $buf = <LOG>;
+    close(LOG);
+    substr($buf, 0, 8) eq "TSHREC1\n"
+	or die "$0: ERROR: $path is not a tsh session log\n";
+
+    for ($pos = 8; $pos < length($buf); ) {
+	$type = substr($buf, $pos++, 1);
+	$t = varint($buf, \$pos);
+	if ($type eq "L") {
+	    $len = varint($buf, \$pos);
+	    push(@out, [$type, $t, substr($buf, $pos, $len)]);
+	    $pos += $len;
+	}
+	elsif ($type eq "S") {
+	    push(@out, [$type, $t, ord(substr($buf, $pos++, 1))]);
+	}
+	elsif ($type eq "C") {
+	    varint($buf, \$pos);
+	    push(@out, [$type, $t, substr($buf, $pos, 2)]);
+	    $pos += 2;
+	}
+	elsif ($type eq "E") {
+	    push(@out, [$type, $t, ""]);
+	}
+	else {
+	    die "$0: ERROR: $path: bad record at byte $pos\n";
+	}
+    }
+    return @out;
+}
+
+sub varint
+{
+    my ($buf, $pos) = @_;
+    my ($v, $shift, $b) = (0, 0, 0);
+
+    do {
+	$b = ord(substr($buf, $$pos++, 1));
+	$v += ($b & 0x7f) * (2 ** $shift);
+	$shift += 7;
+    } while ($b & 0x80);
+    return $v;
+}
+
+#
+# pump - Copy the shell's output to ours until the deadline, noting
+#     when it prints a prompt at the start of a line. With $toprompt,
+#     return as soon as it has.
+#
+sub pump
+{
+    my ($deadline, $toprompt) = @_;
+    my ($rin, $left, $data, $n);
+
+    for (;;) {
+	$left = $deadline - time;
+	$left = 0 if ($left < 0);
+	$rin = '';
+	vec($rin, fileno(Reader), 1) = 1;
+	last if ($eof || select($rin, undef, undef, $left) <= 0);
+	$n = sysread(Reader, $data, 65536);
+	if (!$n) {
+	    $eof = 1;
+	    last;
+	}
+	print $data;
+	STDOUT->flush();
+	$seen .= $data;
+	$seen = substr($seen, -4096) if (length($seen) > 8192);
+	if ($seen =~ /(^|\n)(tsh)?> /) {
+	    $ready = 1;
+	    $seen = "";
+	}
+	last if ($ready && $toprompt);
+    }
+}
@@ -0,0 +1,140 @@
+#include "snap.h"
+#include "jobs.h"
+#include "output.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+
+static_assert(SNAP_MAXJOBS == MAXJOBS, "snap.h must match the job table");
+
+/*************************************
+ * Shared-memory job table snapshot
+ *************************************/
+
+static struct snap_t *snap = NULL;
+static char name[32];
+static int held;                /* snap_hold depth */
+static int stale;               /* the table changed while held */
+
+/* now - CLOCK_REALTIME in ns */
+static long long now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * snap_open - Create the segment and publish the table. Returns 0, or
+ *    -1 after printing why not.
+ */
+int snap_open(void)
+{
+    sigset_t mask, prev;
+    int fd;
+
+    snprintf(name, sizeof(name), SNAP_PREFIX "%d", (int)getpid());
+    if ((fd = shm_open(name, O_CREAT | O_TRUNC | O_RDWR, 0644)) < 0) {
+	out_printf("snap: %s: %s\n", name, strerror(errno));
+	return -1;
+    }
+    if (ftruncate(fd, sizeof(struct snap_t)) < 0 ||
+	(snap = (struct snap_t *)mmap(NULL, sizeof(struct snap_t), PROT_READ | PROT_WRITE,
+				      MAP_SHARED, fd, 0)) == MAP_FAILED) {
+	out_printf("snap: %s: %s\n", name, strerror(errno));
+	close(fd);
+	shm_unlink(name);
+	snap = NULL;
+	return -1;
+    }
+    close(fd);
+    snap->version = SNAP_VERSION;
+    snap->shell = getpid();
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &prev);
+    snap_publish();
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+    __atomic_store_n(&snap->magic, SNAP_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * snap_publish - Copy the job table into the segment under the
+ *    seqlock. Called from sigchld_handler and from the main program
+ *    with SIGCHLD blocked, so that one write never interleaves
+ *    another; the mask is the caller's, set once for all it changes.
+ */
+void snap_publish(void)
+{
+    struct snap_job *s;
+    unsigned seq;
+    int i;
+
+    if (snap == NULL)
+	return;
+    if (held) {
+	stale = 1;
+	return;
+    }
+    seq = snap->seq;
+    __atomic_store_n(&snap->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (i = 0; i < MAXJOBS; i++) {
+	s = &snap->jobs[i];
+	s->pid = jobs[i].pid;
+	s->jid = jobs[i].jid;
+	s->state = jobs[i].state;
+	s->start = jobs[i].start;
+	strncpy(s->cmdline, jobs[i].cmdline, SNAP_CMDLEN - 1);
+	s->cmdline[strcspn(s->cmdline, "\n")] = '\0';
+    }
+    snap->updated = now();
+    __atomic_store_n(&snap->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/*
+ * snap_hold - Put off publishing while the caller changes many jobs
+ *    at once, SIGCHLD blocked throughout; snap_release then publishes
+ *    them as one change
+ */
+void snap_hold(void)
+{
+    held++;
+}
+
+void snap_release(void)
+{
+    if (--held == 0 && stale) {
+	stale = 0;
+	snap_publish();
+    }
+}
+
+/* snap_detach - Unmap the segment, leaving it to the shell (a subshell's) */
+void snap_detach(void)
+{
+    if (snap == NULL)
+	return;
+    munmap(snap, sizeof(struct snap_t));
+    snap = NULL;
+}
+
+/* snap_close - Remove the segment; monitors see the shell is gone */
+void snap_close(void)
+{
+    if (snap == NULL)
+	return;
+    munmap(snap, sizeof(struct snap_t));
+    shm_unlink(name);
+    snap = NULL;
+}
+/*****************************
+ * end job table snapshot
+ *****************************/
@@ -0,0 +1,50 @@
+//-*-c++-*-
+#ifndef _snap_h_
+#define _snap_h_
+
+#include <sys/types.h>
+
+/*
+ * A snapshot of the job table in a POSIX shared memory segment named
+ * /tsh.PID, for tshstat and other monitors. The shell rewrites it on
+ * every job table change; readers map it read-only and never make a
+ * call into the shell.
+ *
+ * The segment is a seqlock: seq is odd while the shell is writing. A
+ * reader loads seq, copies what it needs, loads seq again, and
+ * retries if either load was odd or they differ. seq/2 counts the
+ * changes. Readers must check magic and version first; version
+ * changes whenever this layout does.
+ */
+
+#define SNAP_PREFIX  "/tsh."     /* segment name, then the shell's pid */
+#define SNAP_MAGIC   0x74736a74  /* "tjst" */
+#define SNAP_VERSION 1
+#define SNAP_MAXJOBS 16          /* MAXJOBS */
+#define SNAP_CMDLEN  256         /* command lines are cut to fit */
+
+struct snap_job {
+    pid_t pid;                   /* 0 for an empty slot */
+    int jid;
+    int state;                   /* FG, BG or ST, as in jobs.h */
+    long long start;             /* CLOCK_REALTIME at launch, ns */
+    char cmdline[SNAP_CMDLEN];   /* without its newline */
+};
+
+struct snap_t {
+    unsigned magic;              /* SNAP_MAGIC once the segment is ready */
+    unsigned version;            /* SNAP_VERSION */
+    unsigned seq;                /* seqlock sequence */
+    pid_t shell;                 /* the shell's pid */
+    long long updated;           /* CLOCK_REALTIME of the last change, ns */
+    struct snap_job jobs[SNAP_MAXJOBS];
+};
+
+int snap_open(void);
+void snap_publish(void);          /* SIGCHLD blocked */
+void snap_hold(void);
+void snap_release(void);
+void snap_detach(void);
+void snap_close(void);
+
+#endif
@@ -0,0 +1,145 @@
+#include "spawner.h"
+#include "helper-routines.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <unistd.h>
+
+/*********************************
+ * Threaded spawn engine
+ *********************************/
+
+struct sbatch_t {
+    struct spawnreq *reqs;
+    int n;
+    char **envp;
+    posix_spawnattr_t attr;
+    int next;               /* next request for a thread to claim */
+    int tail;               /* next queue slot for a thread to fill */
+    int *queue;             /* n slots: index+1 of a started request, 0 until filled */
+    sem_t done;             /* one post per filled slot */
+};
+
+/*
+ * worker - Claim requests and start them until none are left. The
+ *    batch outlives every thread: the main thread joins them all
+ *    before it returns.
+ */
+static void *worker(void *arg)
+{
+    struct sbatch_t *b = (struct sbatch_t *)arg;
+    struct spawnreq *r;
+    int i, slot;
+
+    while ((i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->n) {
+	r = &b->reqs[i];
+	if ((r->err = posix_spawn(&r->pid, r->argv[0], NULL, &b->attr, r->argv, b->envp)) != 0)
+	    r->pid = 0;
+
+	/* push: claim a slot, then publish it */
+	slot = __atomic_fetch_add(&b->tail, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&b->queue[slot], i + 1, __ATOMIC_RELEASE);
+	sem_post(&b->done);
+    }
+    return NULL;
+}
+
+/*
+ * startpool - Start up to one thread per CPU (and no more than there
+ *    are requests) on batch b; returns how many started
+ */
+static int startpool(struct sbatch_t *b, pthread_t *threads)
+{
+    sigset_t all, prev;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int want = ncpu < 1 ? 1 : ncpu > SPAWNER_MAXTHREADS ? SPAWNER_MAXTHREADS : (int)ncpu;
+    int n = 0;
+
+    if (want > b->n)
+	want = b->n;
+    sigfillset(&all);                   /* the threads inherit this mask */
+    pthread_sigmask(SIG_SETMASK, &all, &prev);
+    while (n < want && pthread_create(&threads[n], NULL, worker, b) == 0)
+	n++;
+    pthread_sigmask(SIG_SETMASK, &prev, NULL);
+    return n;
+}
+
+/* setattr - Children get their own group and default signal handling */
+static void setattr(posix_spawnattr_t *attr)
+{
+    sigset_t none, def;
+
+    sigemptyset(&none);
+    sigfillset(&def);
+    sigdelset(&def, SIGKILL);
+    sigdelset(&def, SIGSTOP);
+    posix_spawnattr_init(attr);
+    posix_spawnattr_setflags(attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK |
+			     POSIX_SPAWN_SETSIGDEF);
+    posix_spawnattr_setpgroup(attr, 0);
+    posix_spawnattr_setsigmask(attr, &none);
+    posix_spawnattr_setsigdefault(attr, &def);
+}
+
+/*
+ * spawner_run - Start the n requests with environment envp, calling
+ *    started() on the main thread for each as its result comes in (in
+ *    whatever order they finish). Returns how many started. Callers
+ *    must keep SIGCHLD blocked until every child is in the job table;
+ *    the signal stays pending meanwhile, since the threads block it.
+ *    The threads are joined before this returns.
+ */
+int spawner_run(struct spawnreq *reqs, int n, char **envp,
+		void (*started)(struct spawnreq *r, void *arg), void *arg)
+{
+    struct sbatch_t b;
+    pthread_t threads[SPAWNER_MAXTHREADS];
+    int i, head, idx, nthreads, ok = 0;
+
+    if (n <= 0)
+	return 0;
+    memset(&b, 0, sizeof(b));
+    b.reqs = reqs;
+    b.n = n;
+    b.envp = envp;
+    setattr(&b.attr);
+
+    if ((b.queue = (int *)calloc(n, sizeof(int))) == NULL)
+	unix_error("spawner: calloc error");
+    sem_init(&b.done, 0, 0);
+    if ((nthreads = startpool(&b, threads)) == 0) {     /* no threads: start them here */
+	for (i = 0; i < n; i++) {
+	    if ((reqs[i].err = posix_spawn(&reqs[i].pid, reqs[i].argv[0], NULL, &b.attr,
+					   reqs[i].argv, envp)) != 0)
+		reqs[i].pid = 0;
+	    ok += reqs[i].pid != 0;
+	    started(&reqs[i], arg);
+	}
+    }
+
+    /* pop: results in the order their slots were claimed */
+    for (head = 0; nthreads > 0 && head < n; head++) {
+	while (sem_wait(&b.done) < 0)   /* EINTR: ctrl-c, handled meanwhile */
+	    ;
+	while ((idx = __atomic_load_n(&b.queue[head], __ATOMIC_ACQUIRE)) == 0)
+	    sched_yield();              /* its thread claimed it but is still writing */
+	ok += reqs[idx - 1].pid != 0;
+	started(&reqs[idx - 1], arg);
+    }
+    for (i = 0; i < nthreads; i++)      /* back to one thread before any fork */
+	pthread_join(threads[i], NULL);
+
+    sem_destroy(&b.done);
+    free(b.queue);
+    posix_spawnattr_destroy(&b.attr);
+    return ok;
+}
+/*****************************
+ * end threaded spawn engine
+ *****************************/
@@ -0,0 +1,36 @@
+//-*-c++-*-
+#ifndef _spawner_h_
+#define _spawner_h_
+
+#include <sys/types.h>
+
+/*
+ * A spawn engine for starting several background jobs at once. The
+ * requests are handed out to a few threads, each of which starts its
+ * share with posix_spawn (a CLONE_VFORK clone and exec, with no page
+ * tables to copy), so the launches overlap instead of queueing behind
+ * one fork at a time. Each result is pushed onto a
+ * lock-free queue that the main thread drains as results arrive, so
+ * the job table is only ever touched by the shell's own thread.
+ *
+ * The threads block every signal; the shell's handlers keep running
+ * on the main thread alone. They live only for one spawner_run and are
+ * joined before it returns, so the shell is single-threaded again
+ * whenever it forks: a child of fork() runs non-async-signal-safe code
+ * (env_override, stdio) before its exec, which would be unsafe with
+ * other threads around. Children start in their own process group
+ * with default signal handling and an empty signal mask.
+ */
+
+#define SPAWNER_MAXTHREADS 8     /* threads per batch; one per CPU below it */
+
+struct spawnreq {
+    char **argv;            /* argv[0] is the path, as for execve */
+    pid_t pid;              /* set once started, 0 if it could not be */
+    int err;                /* errno from posix_spawn otherwise */
+};
+
+int spawner_run(struct spawnreq *reqs, int n, char **envp,
+		void (*started)(struct spawnreq *r, void *arg), void *arg);
+
+#endif
@@ -0,0 +1,84 @@
+#!/usr/bin/perl
+use Getopt::Std;
+use POSIX ":sys_wait_h";
+use Time::HiRes qw(time);
+
+#######################################################################
+# startbench.pl - Startup latency benchmark for tsh -c
+#
+# Times <n> runs each of
+#
+#     direct      /bin/true on its own
+#     tailexec    tsh -c /bin/true, which execs the command in place of
+#                 the shell
+#     builtin     tsh -c 'true=1', which runs through the full startup
+#                 path (handlers, environment, terminal, eval)
+#
+# and reports the minimum, median and p99 wall time of each in
+# microseconds. The tsh overhead is each case's median less the direct
+# median. Exits nonzero if the tail-exec overhead is 1 ms or more.
+#
+######################################################################
+
+#
+# usage - print help message and terminate
+#
+sub usage
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-h] [-s <shell>] [-n <runs>]\n";
+    printf STDERR "Options:\n";
+    printf STDERR "  -h            Print this message\n";
+    printf STDERR "  -s <shell>    Shell program to test (default ./tsh)\n";
+    printf STDERR "  -n <runs>     Runs per case (default 1000)\n";
+    die "\n" ;
+}
+
+# Parse the command line arguments
+getopts('hs:n:');
+if ($opt_h) {
+    usage();
+}
+$shellprog = $opt_s ? $opt_s : "./tsh";
+$nruns = $opt_n ? $opt_n : 1000;
+
+-x $shellprog
+    or die "$0: ERROR: $shellprog not found or not executable\n";
+
+printf("%-10s %9s %9s %9s %9s\n", "case", "min", "median", "p99", "overhead");
+$base = bench("direct", "/bin/true");
+$tail = bench("tailexec", $shellprog, "-c", "/bin/true");
+bench("builtin", $shellprog, "-c", "true=1");
+
+if ($tail - $base >= 1000) {
+    printf("FAIL: tsh -c startup overhead %.0fus is over 1ms\n", $tail - $base);
+    exit(1);
+}
+exit(0);
+
+#
+# bench - Time $nruns runs of a command, print one line of results
+#     and return the median in microseconds
+#
+sub bench
+{
+    my ($case, @cmd) = @_;
+    my (@t, $i, $pid, $start);
+
+    for ($i = 0; $i < $nruns; $i++) {
+	$start = time;
+	if (($pid = fork()) == 0) {
+	    exec(@cmd);
+	    exit(127);
+	}
+	waitpid($pid, 0);
+	$? == 0
+	    or die "$0: ERROR: @cmd exited with status $?\n";
+	push(@t, (time - $start) * 1e6);
+    }
+    @t = sort { $a <=> $b } @t;
+    $median = $t[int($nruns / 2)];
+    printf("%-10s %7.0fus %7.0fus %7.0fus %7.0fus\n", $case, $t[0], $median,
+	   $t[int($nruns * 0.99)], defined($base) ? $median - $base : 0);
+    return $median;
+}
@@ -0,0 +1,257 @@
+#!/usr/bin/perl
+use Getopt::Std;
+use FileHandle;
+use IPC::Open2;
+use POSIX ":sys_wait_h";
+use Time::HiRes qw(time usleep);
+
+#######################################################################
+# stress.pl - Process-storm stress driver
+#
+# Runs the shell as a child with its stdin and stdout on pipes, drives
+# it through a series of load cases, and reads the shell's own metrics
+# builtin before and after each one.
+#
+# Cases:
+#     spawn       <n> foreground children of ./myusleep that each live
+#                 100 microseconds
+#     burst       <n> background children started <w> at a time and
+#                 timed to exit in the same instant, with a wait after
+#                 each round
+#     tree        <n>/50 foreground ./mytree jobs of 127 processes each
+#     stopcont    <w> background jobs hit with <n>/4 rounds of SIGTSTP
+#                 and SIGCONT to their process groups
+#
+# For every case it reports jobs started per second, the shell's reap
+# delay from entering its SIGCHLD handler to taking the job out of the
+# table (mean, p50 and p99 from its histogram), jobs that were started
+# but never reaped, and zombie children of the shell.
+# Exits nonzero if any case loses a job or leaves a zombie.
+#
+######################################################################
+
+#
+# usage - print help message and terminate
+#
+sub usage
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-h] [-s <shell>] [-n <jobs>] [-w <width>] [-c <cases>]\n";
+    printf STDERR "Options:\n";
+    printf STDERR "  -h            Print this message\n";
+    printf STDERR "  -s <shell>    Shell program to test (default ./tsh)\n";
+    printf STDERR "  -n <jobs>     Jobs per case (default 2000)\n";
+    printf STDERR "  -w <width>    Background jobs at once (default 16)\n";
+    printf STDERR "  -c <cases>    Comma-separated cases (default all)\n";
+    die "\n" ;
+}
+
+# Parse the command line arguments
+getopts('hs:n:w:c:');
+if ($opt_h) {
+    usage();
+}
+$shellprog = $opt_s ? $opt_s : "./tsh";
+$njobs = $opt_n ? $opt_n : 2000;
+$width = $opt_w ? $opt_w : 16;
+@cases = $opt_c ? split(/,/, $opt_c) : ("spawn", "burst", "tree", "stopcont");
+
+-x $shellprog
+    or die "$0: ERROR: $shellprog not found or not executable\n";
+foreach $prog ("./myusleep", "./mytree") {
+    -x $prog
+	or die "$0: ERROR: $prog not found (run make first)\n";
+}
+
+# Fork the shell with pipes on its stdin and stdout
+$pid = open2(\*Reader, \*Writer, "$shellprog -p");
+Writer->autoflush(1);
+$failed = 0;
+
+printf("%-10s %7s %9s %9s %9s %9s %5s %7s\n",
+       "case", "jobs", "jobs/s", "reap-avg", "reap-p50", "reap-p99", "lost", "zombies");
+
+foreach $case (@cases) {
+    %before = metrics();
+    $start = time;
+    if ($case eq "spawn") {
+	feed(map { "./myusleep 100" } (1 .. $njobs));
+    }
+    elsif ($case eq "burst") {
+	@lines = ();
+	for ($i = 0; $i < $njobs; $i += $width) {
+	    push(@lines, (map { "./myusleep 0 20000 &" } (1 .. $width)), "wait");
+	}
+	feed(@lines);
+    }
+    elsif ($case eq "tree") {
+	feed(map { "./mytree 6 2 100" } (1 .. ($njobs / 50 > 0 ? $njobs / 50 : 1)));
+    }
+    elsif ($case eq "stopcont") {
+	stopcont();
+    }
+    else {
+	usage("Unknown case: $case");
+    }
+    %after = quiesce();
+    report($case, time - $start);
+}
+
+# Let the shell exit on EOF
+close Writer;
+waitpid($pid, 0);
+exit($failed ? 1 : 0);
+
+#
+# feed - Send lines and then a metrics command to the shell from a
+#     separate writer process, so that neither side can block on a
+#     full pipe, and read the output as it comes. Returns the metrics;
+#     the other output lines are left in @output.
+#
+sub feed
+{
+    my @lines = @_;
+    my ($writer, %m);
+
+    if (($writer = fork()) == 0) {
+	foreach $line (@lines, "metrics") {
+	    print Writer "$line\n";
+	}
+	exit(0);
+    }
+    %m = readmetrics();
+    waitpid($writer, 0);
+    return %m;
+}
+
+#
+# metrics - Run the metrics builtin and return its samples as a hash
+#
+sub metrics
+{
+    print Writer "metrics\n";
+    return readmetrics();
+}
+
+#
+# readmetrics - Read output up to the end of a metrics listing. Other
+#     output read on the way is left in @output.
+#
+sub readmetrics
+{
+    my %m = ();
+
+    @output = ();
+    while ($line = <Reader>) {
+	if ($line =~ /^([a-z_]+(\{[^}]*\})?) (\S+)$/) {
+	    $m{$1} = $3;
+	    last if ($1 eq "tsh_reap_delay_seconds_count");
+	}
+	elsif ($line !~ /^#/) {
+	    push(@output, $line);
+	}
+    }
+    $line or die "$0: ERROR: $shellprog exited unexpectedly\n";
+    return %m;
+}
+
+#
+# quiesce - Poll the metrics until the job table is empty (or 10 s)
+#
+sub quiesce
+{
+    my %m;
+    my $deadline = time + 10;
+
+    for (;;) {
+	%m = metrics();
+	last if ($m{'tsh_jobs{state="foreground"}'} + $m{'tsh_jobs{state="running"}'} +
+		 $m{'tsh_jobs{state="stopped"}'} == 0 || time > $deadline);
+	usleep(10000);
+    }
+    return %m;
+}
+
+#
+# stopcont - Start a full table of background jobs and storm their
+#     process groups with stop and continue signals
+#
+sub stopcont
+{
+    my @pgids = ();
+    my ($i, $g);
+
+    feed(map { "./myusleep 500000 &" } (1 .. $width));
+    foreach $line (@output) {
+	push(@pgids, $1) if ($line =~ /^\[\d+\] \((\d+)\)/);
+    }
+    for ($i = 0; $i < $njobs / 4; $i++) {
+	foreach $g (@pgids) {
+	    kill('TSTP', -$g);
+	}
+	foreach $g (@pgids) {
+	    kill('CONT', -$g);
+	}
+    }
+    feed("wait");
+}
+
+#
+# quantile - Upper bound of the histogram bucket holding quantile q of
+#     the observations between %before and %after
+#
+sub quantile
+{
+    my ($name, $q) = @_;
+    my $total = $after{"${name}_count"} - $before{"${name}_count"};
+    my ($key, $le, $n);
+
+    return 0 if ($total == 0);
+    foreach $key (sort { bound($a) <=> bound($b) } grep { /^${name}_bucket/ } keys %after) {
+	$n = $after{$key} - $before{$key};
+	return bound($key) if ($n >= $q * $total);
+    }
+    return 0;
+}
+
+sub bound
+{
+    return $_[0] =~ /le="\+Inf"/ ? 9e9 : ($_[0] =~ /le="([^"]+)"/)[0];
+}
+
+#
+# zombies - Count the shell's children that are zombies
+#
+sub zombies
+{
+    my $n = 0;
+    my $stat;
+
+    foreach $stat (glob("/proc/[0-9]*/stat")) {
+	open(STAT, $stat) or next;
+	$line = <STAT>;
+	close(STAT);
+	$n++ if ($line =~ /\) Z (\d+) / && $1 == $pid);
+    }
+    return $n;
+}
+
+#
+# report - Print one line of results for a case
+#
+sub report
+{
+    my ($case, $secs) = @_;
+    my $h = "tsh_reap_delay_seconds";
+    my $started = $after{"tsh_jobs_started_total"} - $before{"tsh_jobs_started_total"};
+    my $reaped = $after{"tsh_jobs_reaped_total"} - $before{"tsh_jobs_reaped_total"};
+    my $count = $after{"${h}_count"} - $before{"${h}_count"};
+    my $avg = $count ? ($after{"${h}_sum"} - $before{"${h}_sum"}) / $count : 0;
+    my $lost = $started - $reaped;
+    my $z = zombies();
+
+    printf("%-10s %7d %9.0f %7.1fus %7.0fus %7.0fus %5d %7d\n", $case, $started,
+	   $secs > 0 ? $started / $secs : 0, $avg * 1e6,
+	   quantile($h, 0.5) * 1e6, quantile($h, 0.99) * 1e6, $lost, $z);
+    $failed = 1 if ($lost != 0 || $z != 0);
+}
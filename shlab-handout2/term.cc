@@ -0,0 +1,83 @@
+#include "term.h"
+#include "helper-routines.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <termios.h>
+#include <signal.h>
+
+/*******************************************
+ * Helper routines for terminal job control
+ *******************************************/
+
+int term_interactive = 0;
+static pid_t shell_pgid;                /* our own process group */
+static struct termios shell_tmodes;     /* terminal modes at the prompt */
+
+/*
+ * term_init - If stdin is a terminal, wait until we are in the
+ *    foreground, put the shell in its own process group and take the
+ *    terminal.
+ */
+void term_init(void)
+{
+    if (!isatty(STDIN_FILENO))
+	return;
+
+    while (tcgetpgrp(STDIN_FILENO) != (shell_pgid = getpgrp()))
+	kill(-shell_pgid, SIGTTIN);
+
+    Signal(SIGTTIN, SIG_IGN);
+    Signal(SIGTTOU, SIG_IGN);
+
+    shell_pgid = getpid();
+    if (getpgrp() != shell_pgid && setpgid(0, shell_pgid) < 0)
+	unix_error("setpgid error");
+    if (tcsetpgrp(STDIN_FILENO, shell_pgid) < 0)
+	unix_error("tcsetpgrp error");
+    tcgetattr(STDIN_FILENO, &shell_tmodes);
+    term_interactive = 1;
+}
+
+/*
+ * term_child - Called in a new child after setpgid: a foreground
+ *    child grabs the terminal itself (so it can't start reading before
+ *    the parent hands it over), then takes back default tty signals.
+ */
+void term_child(int fg)
+{
+    if (!term_interactive)
+	return;
+    if (fg)
+	tcsetpgrp(STDIN_FILENO, getpid());
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+}
+
+/* term_give - Hand the terminal to job, with its saved modes if it has any */
+void term_give(struct job_t *job)
+{
+    if (!term_interactive)
+	return;
+    if (job->has_tmodes)
+	tcsetattr(STDIN_FILENO, TCSADRAIN, &job->tmodes);
+    tcsetpgrp(STDIN_FILENO, job->pid);
+}
+
+/*
+ * term_take - Take the terminal back after a foreground job stopped
+ *    or ended; a stopped job's modes are saved for when it resumes.
+ */
+void term_take(struct job_t *job)
+{
+    if (!term_interactive)
+	return;
+    tcsetpgrp(STDIN_FILENO, shell_pgid);
+    if (job != NULL) {
+	tcgetattr(STDIN_FILENO, &job->tmodes);
+	job->has_tmodes = 1;
+    }
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &shell_tmodes);
+}
+/*****************************
+ * end terminal job control
+ *****************************/
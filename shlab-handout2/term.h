@@ -0,0 +1,19 @@
+//-*-c++-*-
+#ifndef _term_h_
+#define _term_h_
+
+#include "jobs.h"
+
+/*
+ * Terminal job control. When stdin is a tty the foreground job owns
+ * the terminal (tcsetpgrp), so the kernel delivers ctrl-c/ctrl-z to
+ * it directly instead of through the shell's signal handlers.
+ */
+extern int term_interactive;   /* stdin is a tty we control */
+
+void term_init(void);
+void term_child(int fg);
+void term_give(struct job_t *job);
+void term_take(struct job_t *job);
+
+#endif
@@ -0,0 +1,197 @@
+#include "timer.h"
+#include "jobs.h"
+#include "helper-routines.h"
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/time.h>
+
+/*********************************************
+ * Helper routines for job deadlines (timeout)
+ *********************************************/
+
+static struct deadline_t *heap = NULL;  /* min-heap on when */
+static int nheap = 0, capheap = 0;
+static pid_t fired[MAXJOBS];            /* ring of jobs a deadline signalled */
+static int nfired = 0;
+
+/* timer_now - CLOCK_MONOTONIC in nanoseconds */
+long long timer_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void swap(int i, int j)
+{
+    struct deadline_t t = heap[i];
+
+    heap[i] = heap[j];
+    heap[j] = t;
+}
+
+static void siftup(int i)
+{
+    while (i > 0 && heap[(i-1)/2].when > heap[i].when) {
+	swap(i, (i-1)/2);
+	i = (i-1)/2;
+    }
+}
+
+static void siftdown(int i)
+{
+    int c;
+
+    while ((c = 2*i + 1) < nheap) {
+	if (c + 1 < nheap && heap[c+1].when < heap[c].when)
+	    c++;
+	if (heap[i].when <= heap[c].when)
+	    break;
+	swap(i, c);
+	i = c;
+    }
+}
+
+/* arm - Point the interval timer at the earliest deadline (or disarm it) */
+static void arm(void)
+{
+    struct itimerval it = { { 0, 0 }, { 0, 0 } };
+    long long delta;
+
+    if (nheap > 0) {
+	delta = heap[0].when - timer_now();
+	if (delta < 1000)
+	    delta = 1000;               /* already due: fire right away */
+	it.it_value.tv_sec = delta / 1000000000LL;
+	it.it_value.tv_usec = (delta % 1000000000LL) / 1000;
+	if (it.it_value.tv_sec == 0 && it.it_value.tv_usec == 0)
+	    it.it_value.tv_usec = 1;
+    }
+    setitimer(ITIMER_REAL, &it, NULL);
+}
+
+/*
+ * timer_add - Send SIGTERM to job pid's process group after delay ns,
+ *    and SIGKILL grace ns after that unless grace is negative.
+ */
+void timer_add(pid_t pid, long long delay, long long grace)
+{
+    sigset_t mask, prev;
+    static int installed = 0;
+
+    if (!installed) {
+	Signal(SIGALRM, sigalrm_handler);
+	installed = 1;
+    }
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGALRM);
+    sigaddset(&mask, SIGCHLD);          /* sigchld_handler cancels deadlines */
+    sigprocmask(SIG_BLOCK, &mask, &prev);
+    if (nheap == capheap) {
+	capheap = capheap ? 2 * capheap : 32;
+	if ((heap = (struct deadline_t *)realloc(heap, capheap * sizeof(*heap))) == NULL)
+	    unix_error("timer: realloc error");
+    }
+    heap[nheap].when = timer_now() + delay;
+    heap[nheap].pid = pid;
+    heap[nheap].sig = SIGTERM;
+    heap[nheap].grace = grace;
+    siftup(nheap++);
+    arm();
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+}
+
+/*
+ * timer_cancel - Drop the deadlines of job pid, which has ended, so
+ *    that a new job that gets its pid is never signalled in its place.
+ *    Called from sigchld_handler; async-signal-safe.
+ */
+void timer_cancel(pid_t pid)
+{
+    sigset_t mask, prev;
+    int i, removed = 0;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGALRM);
+    sigprocmask(SIG_BLOCK, &mask, &prev);
+    for (i = 0; i < nheap; )
+	if (heap[i].pid == pid) {
+	    heap[i] = heap[--nheap];
+	    removed = 1;
+	}
+	else
+	    i++;
+    if (removed) {
+	for (i = nheap / 2 - 1; i >= 0; i--)
+	    siftdown(i);
+	arm();
+    }
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+}
+
+/* timer_detach - Forget the deadlines, which are the shell's (a subshell's) */
+void timer_detach(void)
+{
+    nheap = 0;
+    nfired = 0;
+    memset(fired, 0, sizeof(fired));
+    arm();
+}
+
+/* timer_fired - Did a deadline signal job pid? Clears the mark; from sigchld_handler */
+int timer_fired(pid_t pid)
+{
+    int i;
+
+    for (i = 0; i < MAXJOBS; i++)
+	if (fired[i] == pid) {
+	    fired[i] = 0;
+	    return 1;
+	}
+    return 0;
+}
+
+/*
+ * sigalrm_handler - Signal every job whose deadline has passed. A
+ *    SIGTERM with a grace period queues the SIGKILL in the same slot,
+ *    so the heap never grows here. Ended jobs have no deadlines left
+ *    (see timer_cancel), and any that are not in the table are skipped.
+ */
+void sigalrm_handler(int sig)
+{
+    long long now = timer_now();
+    struct job_t *job;
+    sigset_t mask, prev;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);          /* keep timer_cancel off the heap meanwhile */
+    sigprocmask(SIG_BLOCK, &mask, &prev);
+
+    while (nheap > 0 && heap[0].when <= now) {
+	struct deadline_t d = heap[0];
+
+	if ((job = getjobpid(jobs, d.pid)) != NULL) {
+	    kill(-d.pid, d.sig);
+	    if (job->state == ST)
+		kill(-d.pid, SIGCONT);          /* a stopped job must wake to die */
+	    if (d.sig == SIGTERM)
+		fired[nfired++ % MAXJOBS] = d.pid;
+	}
+	if (job != NULL && d.sig == SIGTERM && d.grace >= 0) {
+	    heap[0].when = now + d.grace;
+	    heap[0].sig = SIGKILL;
+	}
+	else
+	    heap[0] = heap[--nheap];
+	siftdown(0);
+    }
+    arm();
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+}
+/*****************************
+ * end job deadlines
+ *****************************/
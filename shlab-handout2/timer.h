@@ -0,0 +1,27 @@
+//-*-c++-*-
+#ifndef _timer_h_
+#define _timer_h_
+
+#include <sys/types.h>
+
+/*
+ * Job deadlines for the timeout builtin. All deadlines share one
+ * min-heap and one interval timer armed for the earliest of them, so
+ * any number of them costs no extra processes or threads.
+ */
+
+struct deadline_t {
+    long long when;         /* CLOCK_MONOTONIC expiry, ns */
+    pid_t pid;              /* job (process group) to signal */
+    int sig;                /* signal to send */
+    long long grace;        /* SIGKILL this long after SIGTERM, <0 for never */
+};
+
+long long timer_now(void);
+void timer_add(pid_t pid, long long delay, long long grace);
+void timer_cancel(pid_t pid);
+void timer_detach(void);
+int timer_fired(pid_t pid);
+void sigalrm_handler(int sig);
+
+#endif
@@ -13,13 +13,38 @@ using namespace std;
 #include <sys/wait.h>
 #include <errno.h>
 #include <string>
+#include <sys/stat.h>
+#include <poll.h>
+#include <fcntl.h>
 
 #include "globals.h"
 #include "jobs.h"
 #include "helper-routines.h"
+#include "parsecache.h"
+#include "expand.h"
+#include "vm.h"
+#include "env.h"
+#include "term.h"
+#include "timer.h"
+#include "jtop.h"
+#include "input.h"
+#include "ctl.h"
+#include "metrics.h"
+#include "output.h"
+#include "dag.h"
+#include "memo.h"
+#include "builtin.h"
+#include "batch.h"
+#include "snap.h"
+#include "record.h"
+#include "limit.h"
+#include "reaper.h"
+#include "spawner.h"
 
 static char prompt[] = "tsh> ";
+static char prompt2[] = "> ";   // continuation prompt inside for/while/if
 int verbose = 0;
+int last_status = 0;
 
 //
 // You need to implement the functions eval, builtin_cmd, do_bgfg,
@@ -29,11 +54,19 @@ int verbose = 0;
 // so that earlier code can refer to them. You need to fill in the
 // function bodies below.
 //
-void do_bgfg(char **argv);
+int do_bgfg(char **argv);
 void waitfg(pid_t pid);
+void waitevent(const sigset_t *prev);
+void teardown(void);
 void eval(char *cmdline);
+void tailexec(const char *command);
+pid_t spawn(char **argv, char **assign, int nassign, int bg, int quiet, char *cmdline, const int *redir);
+int spawn_batch(char ***argvs, char **cmdlines, int n, int quiet, pid_t *pids);
 int builtin_cmd(char **argv);
 
+static struct pcmd_t *curcmd = NULL;  // the line a running builtin came from
+static int subshell = -1;  // a builtin for spawn() to run in the child instead of exec
+
 //sigs
 void sigchld_handler(int sig);
 void sigtstp_handler(int sig);
@@ -45,14 +78,17 @@ void sigint_handler(int sig);
 int main(int argc, char **argv)
 {
   int emit_prompt = 1;
+  char *ctlpath = NULL;  // control socket, if any
+  char *command = NULL;  // -c: run just this and exit
+  int publish = 0;       // -j: job table snapshot in shared memory
+  char *recpath = NULL;  // -R: session log
+  int subreaper = 0;     // -r: reap and account for orphaned descendants
 
-  // Redirect stderr to stdout (so that driver will get all output
-  // on the pipe connected to stdout)
-  dup2(1, 2);
+  atexit(out_flush);
 
   /* Parse the command line */
   char c;
-  while ((c = getopt(argc, argv, "hvp")) != EOF) {
+  while ((c = getopt(argc, argv, "hvpjrS:M:c:R:")) != EOF) {
     switch (c) {
     case 'h':             // print help message
       usage();
@@ -63,11 +99,42 @@ int main(int argc, char **argv)
     case 'p':             // don't print a prompt
       emit_prompt = 0;  // handy for automatic testing
       break;
+    case 'j':             // publish the job table for tshstat
+      publish = 1;
+      break;
+    case 'r':             // reap orphaned descendants of jobs
+      subreaper = 1;
+      break;
+    case 'S':             // accept jobs on a control socket
+      ctlpath = optarg;
+      break;
+    case 'M':             // keep a metrics textfile up to date
+      metrics_setfile(optarg);
+      break;
+    case 'R':             // record the session for replay.pl
+      recpath = optarg;
+      break;
+    case 'c':             // one-shot: run a single command line
+      command = optarg;
+      break;
     default:
       usage();
     }
   }
 
+  //
+  // tsh -c: a plain external command simply replaces the shell, with
+  // no setup at all; anything else falls through to the normal setup
+  // and is run once below
+  //
+  if (command != NULL)
+    tailexec(command);
+  else {
+    // Redirect stderr to stdout (so that driver will get all output
+    // on the pipe connected to stdout)
+    dup2(1, 2);
+  }
+
 
   Signal(SIGINT,  sigint_handler);   // ctrl-c
   Signal(SIGTSTP, sigtstp_handler);  // ctrl-z
@@ -79,9 +146,33 @@ int main(int argc, char **argv)
   Signal(SIGQUIT, sigquit_handler);
 
   //
-  // Initialize the job list
+  // Load the environment store (the job list is static, so it
+  // starts out cleared)
   //
-  initjobs(jobs);
+  env_init(environ);
+
+  //
+  // With a terminal on stdin, foreground jobs get the terminal and
+  // the kernel signals them directly; otherwise (the trace driver)
+  // the handlers above forward ctrl-c/ctrl-z
+  //
+  term_init();
+
+  if (ctlpath != NULL && ctl_open(ctlpath) == 0)
+    atexit(ctl_close);
+  if (publish && snap_open() == 0)
+    atexit(snap_close);
+  if (recpath != NULL)
+    rec_open(recpath);
+  if (subreaper && reaper_init() < 0)
+    out_printf("tsh: cannot become a child subreaper: %s\n", strerror(errno));
+
+  if (command != NULL) {
+    std::string line = std::string(command) + "\n";
+    if (!vm_feed(&line[0]))
+      eval(&line[0]);
+    exit(vm_pending() ? 2 : last_status);  // an unfinished for/while/if
+  }
 
   //
   // Execute the shell's read/eval loop
@@ -90,28 +181,28 @@ int main(int argc, char **argv)
     //
     // Read command line
     //
-    if (emit_prompt) {
-      printf("%s", prompt);
-      fflush(stdout);
-    }
+    // Start whatever after-commands became ready meanwhile; their
+    // output goes out together with the prompt
+    dag_run();
+    out_prompt(emit_prompt ? (vm_pending() ? prompt2 : prompt) : NULL);
 
-    char cmdline[MAXLINE];
+    char *cmdline;
 
-    if ((fgets(cmdline, MAXLINE, stdin) == NULL) && ferror(stdin)) {
-      app_error("fgets error");
-    }
     // End of file? (did user type ctrl-d?)
-    if (feof(stdin)) {
-      fflush(stdout);
+    if ((cmdline = input_getline()) == NULL) {
+      rec_eof();
+      out_flush();
       exit(0);
     }
 
+    rec_line(cmdline);
+
     //
-    // Evaluate command line
+    // Evaluate command line; for/while/if and && / || lists are
+    // compiled and run by the VM instead
     //
-    eval(cmdline);
-    fflush(stdout);
-    fflush(stdout);
+    if (!vm_feed(cmdline))
+      eval(cmdline);
   }
 
   exit(0); //control never reaches here
@@ -129,120 +220,984 @@ int main(int argc, char **argv)
 // background children don't receive SIGINT (SIGTSTP) from the kernel
 // when we type ctrl-c (ctrl-z) at the keyboard.
 //
+// Parsing goes through the parsed-command cache, so a line that has
+// been seen recently skips tokenizing and builtin lookup entirely.
+// $NAME references are expanded first; the cache is keyed by the
+// expanded text. Leading NAME=value words set shell variables when
+// they stand alone, and are layered over the environment of the child
+// otherwise.
+//
 void eval(char *cmdline)
 {
-  /* Parse command line */
-  char *argv[MAXARGS];
+  char *expanded = NULL;
+  int cap = 0;
+
+  /* Parse command line (or fetch the parse from the cache) */
+  struct pcmd_t *cmd = pc_lookup(expand_alloc(cmdline, &expanded, &cap));
+  free(expanded);  // the cache entry has its own copy
+  char **argv = cmd->argv + cmd->nassign;
+  pid_t pid; //init process id
+
+  if (argv[0] == NULL) {
+    for (int i = 0; i < cmd->nassign; i++)  //bare assignments
+      env_put(cmd->argv[i]);
+    if (cmd->nassign > 0)
+      last_status = 0;
+    pc_release(cmd);
+    return;   //to prevent against empty lines
+  }
+
+  if (cmd->builtin >= 0) { //builtins were resolved when the line was parsed
+    struct pcmd_t *outer = curcmd;
+    curcmd = cmd;
+    last_status = builtin_run(cmd->builtin, argv);
+    curcmd = outer;
+    pc_release(cmd);
+    return;
+  }
+
+  if ((pid = spawn(argv, cmd->argv, cmd->nassign, cmd->bg, 0, cmdline, NULL)) != 0 && !cmd->bg)
+    waitfg(pid);
+  pc_release(cmd);
+}
+
+//
+// capture - Run cmdline for a command substitution, collecting its
+//    output in c. A builtin runs right here with the shell's output
+//    diverted into c, unless it starts jobs or writes to fd 1 itself
+//    (see builtin_forks); that one, and anything else, runs as a
+//    foreground job writing into a pipe, enlarged so that it fills in
+//    big reads, which go straight into c as it grows. Sets last_status.
+//
+int capture(const char *cmdline, struct outcap *c)
+{
+  char *expanded = NULL;
+  int cap = 0;
+  struct pcmd_t *cmd = pc_lookup(expand_alloc((char *)cmdline, &expanded, &cap));
+  char **argv = cmd->argv + cmd->nassign;
+  int fds[2], redir[3] = { -1, -1, -1 }, n;
+  sigset_t mask, prev;
+  struct pollfd pfd;
+  pid_t pid;
+
+  free(expanded);
+  if (argv[0] == NULL) {
+    pc_release(cmd);
+    return last_status = 0;
+  }
+
+  if (cmd->builtin >= 0 && !builtin_forks(cmd->builtin)) {
+    struct pcmd_t *outer = curcmd;
+    curcmd = cmd;
+    out_capture(c);
+    last_status = builtin_run(cmd->builtin, argv);
+    out_endcapture(c);
+    curcmd = outer;
+    pc_release(cmd);
+    return last_status;
+  }
+
+  if (pipe2(fds, O_CLOEXEC) < 0) {
+    out_printf("capture: pipe error: %s\n", strerror(errno));
+    pc_release(cmd);
+    return last_status = 1;
+  }
+  fcntl(fds[1], F_SETPIPE_SZ, SUBST_PIPESZ);  // best effort: pipe-max-size may be lower
+  redir[1] = fds[1];
+  struct pcmd_t *outer = curcmd;
+  curcmd = cmd;
+  subshell = cmd->builtin;
+  pid = spawn(argv, cmd->argv, cmd->nassign, 0, 1, (char *)cmdline, redir);
+  subshell = -1;
+  curcmd = outer;
+  close(fds[1]);
+  pc_release(cmd);
+
+  //
+  // Read until EOF, or until the job stops: ppoll lets SIGCHLD in only
+  // while we sleep, so a ctrl-z always wakes us to look
+  //
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, &prev);
+  pfd.fd = fds[0];
+  pfd.events = POLLIN;
+  while (pid != 0) {
+    if (ppoll(&pfd, 1, NULL, &prev) < 0) {
+      struct job_t *job = getjobpid(jobs, pid);
+      if (job != NULL && job->state == ST)
+        break;                            // stopped: keep what we have
+      continue;
+    }
+    out_grow(c, c->len + SUBST_PIPESZ);
+    if ((n = read(fds[0], c->buf + c->len, c->cap - 1 - c->len)) <= 0)
+      break;
+    c->len += n;
+  }
+  sigprocmask(SIG_SETMASK, &prev, NULL);
+  close(fds[0]);
+  if (pid != 0)
+    waitfg(pid);
+  return last_status;
+}
+
+//
+// tailexec - For tsh -c: exec command in place of the shell if it is a
+//    single external command that needs nothing from the shell (no
+//    variables, substitutions, assignments, control flow, builtin or
+//    &). Returns otherwise.
+//
+void tailexec(const char *command)
+{
+  char line[MAXLINE], buf[MAXLINE], *argv[MAXARGS];
+
+  if (strlen(command) + 2 > sizeof(line) || strpbrk(command, "$`") != NULL)
+    return;
+  snprintf(line, sizeof(line), "%s\n", command);
+  if (vm_iscontrol(line) || parseline(line, buf, argv) || argv[0] == NULL ||
+      env_assignment(argv[0]) || builtin_lookup(argv[0]) >= 0)
+    return;
+  execve(argv[0], argv, environ);
+  out_printf("%s : Command not found. \n", argv[0]);
+  exit(127);
+}
+
+//
+// subshell_init - In a child forked for $(builtin): let go of the
+//    shell's jobs, deadlines, commands, limits and files, so that the
+//    builtin sees a shell of its own and leaves the parent's alone
+//
+static void subshell_init(void)
+{
+  subshell = -1;
+  initjobs(jobs);
+  reaper_on = 0;       // the subreaper mark is not inherited
+  term_interactive = 0;  // the terminal stays with our group
+  timer_detach();
+  dag_detach();
+  limit_detach();
+  metrics_setfile(NULL);
+  snap_detach();
+  rec_detach();
+  ctl_detach();
+}
+
+//
+// spawn - Fork argv as a new job with its own process group and add
+//    it to the job list, in the background if bg is set (announced
+//    with its job ID unless quiet). The nassign NAME=value strings in
+//    assign go into the child's environment only. If redir is not
+//    NULL, the child's fds 0-2 are replaced by those of its entries
+//    that are not -1. Returns the job's pid (the caller waits for a
+//    foreground job), or 0 if it could not be started.
+//
+pid_t spawn(char **argv, char **assign, int nassign, int bg, int quiet, char *cmdline, const int *redir)
+{
   pid_t pid; //init process id
   sigset_t set; //init signal
+  long long start;
 
+  if (limit_admit() < 0) {  //over the spawn limits, and ctrl-c came while we waited
+    last_status = 128 + SIGINT;
+    return 0;
+  }
+  start = timer_now();
   sigemptyset(&set); //initialize set to be empty
   sigaddset(&set, SIGCHLD); //add sigchild to set -SIGCHLD is sent when child terminates
-  // The 'bg' variable is 1 (true) if the job should run
 
-  int bg = parseline(cmdline, argv); // reads in from command line and returns 0 if foreground and 1 if background, just like above
-  if (argv[0] == NULL)
-    return;   //to prevent against empty lines
+  sigprocmask(SIG_BLOCK, &set, NULL); //parent blocks SIGCHILD signal temporarily so child can run
+  out_flush();  //our output so far goes before anything the child prints
+  pid = fork();
+  if (pid < 0) {
+    out_printf("fork() : forking error\n");
+    limit_cancel();
+    last_status = 1;
+    sigprocmask(SIG_UNBLOCK, &set, NULL);
+    return 0;
+  }
+  if (pid == 0) {
+    setpgid(0,0); //child gets its own process group so it alone sees our forwarded signals
+    out_discard();
+    term_child(!bg);
+    sigprocmask(SIG_UNBLOCK, &set, NULL);
+    for (int i = 0; i < nassign; i++)  //VAR=x cmd: only this child sees it
+      env_override(assign[i]);
+    for (int fd = 0; redir != NULL && fd < 3; fd++)
+      if (redir[fd] >= 0 && redir[fd] != fd)
+        dup2(redir[fd], fd);
+    if (subshell >= 0) {  //$(builtin): run it here, as a shell of our own
+      int i = subshell;
+      subshell_init();
+      int rc = builtin_run(i, argv);
+      out_flush();
+      fflush(stdout);
+      _exit(rc);
+    }
+    if (execve(argv[0], argv, env_envp()) < 0) {
+      if (errno == E2BIG)
+        out_printf("%s : Argument list too long. \n", argv[0]);
+      else
+        out_printf("%s : Command not found. \n", argv[0]);
+      out_flush();
+      _exit(127);   //exit() would rewind our shared stdin to its stdio position
+    }
+  }
 
-    if (builtin_cmd(argv)==0){ //if parameter is not a built in function fork a child and cont.
-
-			sigprocmask(SIG_BLOCK, &set, NULL); //parent blocks SIGCHILD signal temporarily so child can run
-			pid = fork();
-			if(pid < 0){
-					printf("fork() : forking error\n");
-					return;
-				}
-			if(pid == 0){
-					setpgid(0,0); //if first parameter is zero, sets pid to the parent.
-          //second parameter is zero, sets pgid to above parent.
-									//group id refers to all the children and parent.
-			if (execve(argv[0], argv, environ) < 0){ //helps prevent against recursively calling child processes
-					printf("%s : Command not found. \n", argv[0]);
-					exit(0);
-				}
-				}
-	else{						//parent process
-		if(bg == 0){			//Fg
-				if(!addjob(jobs, pid, FG, cmdline)){
-						return; //add pid to job list in the current state of fg
-					}
-				sigprocmask(SIG_UNBLOCK, &set, NULL);  //unblock sigs
+  //parent process
+  setpgid(pid, pid); //also here, so the group exists before anyone signals or samples it
+  if (bg == 0) {			//Fg
+    if (!addjob(jobs, pid, FG, cmdline)) { //add pid to job list in the current state of fg
+      sigprocmask(SIG_UNBLOCK, &set, NULL);
+      return 0;
+    }
+    term_give(getjobpid(jobs, pid));
+  }
+  else {
+    if (!addjob(jobs, pid, BG, cmdline)) { //add pid to joblist in current state of bg
+      sigprocmask(SIG_UNBLOCK, &set, NULL);
+      return 0;
+    }
+    last_status = 0;
+    if (!quiet)
+      out_safef("[%d] (%d) %s\n", pid2jid(pid), pid, cmdline); //dispaly it all to user
+  }
+  metrics_spawned(timer_now() - start);
+  sigprocmask(SIG_UNBLOCK, &set, NULL);  //unblock sigs
+  return pid;
+}
 
-				waitfg(pid); //unblock so that grandchildren dont block and wait
-			}
-		else{
-				if(!addjob(jobs, pid, BG, cmdline)){
-						return; //add pid to joblist in current state of bg
-					}
-				sigprocmask(SIG_UNBLOCK, &set, NULL);
-				printf("[%d] (%d) %s\n", pid2jid(pid), pid, cmdline); //dispaly it all to user
-			}
-		}
-		  return;
+//
+// spawn_batch - Start n background jobs at once: argvs[i] as job
+//    cmdlines[i], announced unless quiet. They are started on the
+//    spawner's threads and entered in the job table here as each
+//    result comes back. Sets pids[i] to each job's pid, or 0 if it
+//    could not be started, and returns how many were. One job alone
+//    just goes through spawn(). No assignments or redirections. The
+//    spawn limits hold as for spawn(): a launch over them waits.
+//
+struct batchctx_t {
+  struct spawnreq *reqs;
+  char **cmdlines;
+  pid_t *pids;
+  int quiet;
+  long long start;
+};
 
-		}
-	}
+static void batch_started(struct spawnreq *r, void *arg)
+{
+  struct batchctx_t *ctx = (struct batchctx_t *)arg;
+  int i = r - ctx->reqs;
+
+  ctx->pids[i] = 0;
+  if (r->pid == 0) {
+    if (r->err == E2BIG)
+      out_printf("%s : Argument list too long. \n", r->argv[0]);
+    else
+      out_printf("%s : Command not found. \n", r->argv[0]);
+    limit_cancel();
+    return;
+  }
+  if (!addjob(jobs, r->pid, BG, ctx->cmdlines[i]))
+    return;
+  ctx->pids[i] = r->pid;
+  if (!ctx->quiet)
+    out_safef("[%d] (%d) %s\n", pid2jid(r->pid), r->pid, ctx->cmdlines[i]);
+  metrics_spawned(timer_now() - ctx->start);
+}
+
+//
+// startchunk - Start the n admitted jobs at argvs on the spawner
+//
+static int startchunk(char ***argvs, char **cmdlines, int n, int quiet, pid_t *pids)
+{
+  struct spawnreq *reqs;
+  struct batchctx_t ctx;
+  sigset_t set, prev;
+  int i, ok;
+
+  if ((reqs = (struct spawnreq *)malloc(n * sizeof(struct spawnreq))) == NULL)
+    unix_error("spawn_batch: malloc error");
+  for (i = 0; i < n; i++)
+    reqs[i].argv = argvs[i];
+  ctx.reqs = reqs;
+  ctx.cmdlines = cmdlines;
+  ctx.pids = pids;
+  ctx.quiet = quiet;
+  ctx.start = timer_now();
+
+  //
+  // SIGCHLD stays blocked until every child is in the job table, so
+  // none can be reaped before it is known
+  //
+  sigemptyset(&set);
+  sigaddset(&set, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &set, &prev);
+  out_flush();
+  snap_hold();  //the whole chunk goes to the snapshot as one change
+  spawner_run(reqs, n, env_envp(), batch_started, &ctx);
+  snap_release();
+  for (ok = 0, i = 0; i < n; i++)
+    ok += pids[i] != 0;
+  sigprocmask(SIG_SETMASK, &prev, NULL);
+  free(reqs);
+  return ok;
+}
+
+int spawn_batch(char ***argvs, char **cmdlines, int n, int quiet, pid_t *pids)
+{
+  int i, m, ok = 0;
+
+  if (n == 1)
+    return (pids[0] = spawn(argvs[0], NULL, 0, 1, quiet, cmdlines[0], NULL)) != 0;
+
+  //
+  // Start them in chunks: each is what the spawn limits admit at once,
+  // waiting (with nothing in flight) only for the first of a chunk
+  //
+  last_status = 0;
+  for (i = 0; i < n; i += m) {
+    if (limit_admit() < 0) {
+      for (; i < n; i++)
+        pids[i] = 0;
+      last_status = 128 + SIGINT;
+      break;
+    }
+    for (m = 1; i + m < n && limit_tryadmit() == 0; m++)
+      ;
+    ok += startchunk(argvs + i, cmdlines + i, m, quiet, pids + i);
+  }
+  return ok;
+}
 
 
 
 /////////////////////////////////////////////////////////////////////////////
 //
-// builtin_cmd
+// builtin_cmd - Run argv if it names a builtin, return 0 if it does not
+//
 int builtin_cmd(char **argv)
 {
+  int i = builtin_lookup(argv[0]);
 
-  if (strcmp(argv[0], "quit") == 0) {    //if first arguement is quit, then we exit
-		exit(0);
-	}
-  if (strcmp(argv[0], "jobs") == 0) {   //if first parameter is jobs show jobs
-		listjobs(jobs);
-		return 1;
-	  }
-  if (strcmp(argv[0], "fg") == 0) {   //if parameter is fg call do_bgfg
-		do_bgfg(argv);
-		return 1;
-	  }
-  if (strcmp(argv[0], "bg") == 0) {   //if parameter is bg call do_bgfg
-		do_bgfg(argv);
-		return 1;
-	  }
+  if (i < 0)
+    return 0;   //must not be a built in command if it makes it to here
+  last_status = builtin_run(i, argv);
+  return 1;
+}
+
+//
+// do_quit - quit builtin: leave the shell
+//
+int do_quit(char **argv)
+{
+  teardown();
+  exit(0);
+}
+
+//
+// do_jobs - jobs builtin: list the job table
+//
+int do_jobs(char **argv)
+{
+  listjobs(jobs);
+  return 0;
+}
+
+//
+// do_cmdcache - cmdcache builtin: report parsed-command cache counters
+//
+int do_cmdcache(char **argv)
+{
+  unsigned long hits, misses;
+  int entries;
+
+  pc_stats(&hits, &misses, &entries);
+  out_printf("cmdcache: %lu hits, %lu misses, %d/%d entries\n",
+             hits, misses, entries, PCACHE_SIZE);
+  return 0;
+}
+
+//
+// do_export - export builtin: export NAME=value, or NAME (empty if unset)
+//
+int do_export(char **argv)
+{
+  int rc = 0;
+
+  if (argv[1] == NULL)
+    return do_env(argv);
+  for (int i = 1; argv[i] != NULL; i++) {
+    if (env_assignment(argv[i]) || isalpha(argv[i][0]) || argv[i][0] == '_')
+      env_export(argv[i]);
+    else {
+      out_printf("export: `%s': not a valid identifier\n", argv[i]);
+      rc = 1;
+    }
+  }
+  return rc;
+}
+
+//
+// do_unset - unset builtin: remove variables from the environment
+//
+int do_unset(char **argv)
+{
+  for (int i = 1; argv[i] != NULL; i++)
+    env_unset(argv[i]);
+  return 0;
+}
+
+//
+// do_env - env builtin: print the environment children get
+//
+int do_env(char **argv)
+{
+  for (char **envp = env_envp(); *envp != NULL; envp++)
+    out_printf("%s\n", *envp);
+  return 0;
+}
+
+//
+// do_wait - wait builtin
+//
+//   wait          block until no job is running in the background
+//   wait %n|pid   block until that job ends, return its exit status
+//   wait -n       block until the next job ends, return its status
+//
+// Like waitfg, this sleeps in waitevent and is woken by the child
+// events sigchld_handler records. ctrl-c interrupts it with status 130.
+//
+int do_wait(char **argv)
+{
+  sigset_t mask, prev;
+  struct job_t *jobp = NULL;
+  struct done_t *d = NULL;
+  pid_t pid = 0;
+  int rc = 0, anyjob = !strcmp(argv[1] ? argv[1] : "", "-n");
+
+  if (argv[1] != NULL && !anyjob) {
+    if (argv[1][0] == '%') {
+      if ((jobp = getjobjid(jobs, atoi(&argv[1][1]))) != NULL)
+        pid = jobp->pid;
+      else if ((d = getdonejid(atoi(&argv[1][1]))) != NULL)
+        pid = d->pid;  // already finished: its status is in the ring
+      else {
+        out_printf("wait: %s: No such job\n", argv[1]);
+        return 127;
+      }
+    }
+    else if (isdigit(argv[1][0])) {
+      pid = atoi(argv[1]);
+      if (getjobpid(jobs, pid) == NULL && getdone(pid) == NULL) {
+        out_printf("wait: pid %d is not a child of this shell\n", pid);
+        return 127;
+      }
+    }
+    else {
+      out_printf("wait: %s: argument must be a PID or %%jobid\n", argv[1]);
+      return 2;
+    }
+  }
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, &prev);
+  vm_interrupt = 0;
+  for (;;) {
+    if (vm_interrupt) {
+      rc = 128 + SIGINT;
+      break;
+    }
+    if (pid != 0) {                       // wait %n / wait pid
+      if ((jobp = getjobpid(jobs, pid)) == NULL) {
+        d = getdone(pid);
+        break;
+      }
+      if (jobp->state == ST) {
+        rc = 128 + SIGTSTP;
+        break;
+      }
+    }
+    else if (anyjob) {                    // wait -n
+      if ((d = nextdone()) != NULL)
+        break;
+      int running = dag_pending();
+      for (int i = 0; i < MAXJOBS; i++)
+        running += jobs[i].state == BG;
+      if (!running) {
+        rc = 127;
+        break;
+      }
+    }
+    else {                                // wait
+      int running = dag_pending();
+      for (int i = 0; i < MAXJOBS; i++)
+        running += jobs[i].state == BG;
+      if (!running)
+        break;
+    }
+    waitevent(&prev);
+    dag_run();
+  }
+  if (d != NULL) {
+    d->waited = 1;
+    rc = d->status;
+  }
+  sigprocmask(SIG_SETMASK, &prev, NULL);
+  return rc;
+}
+
+//
+// parseduration - Seconds with an optional s/m/h/d suffix, in ns; -1 if bad
+//
+static long long parseduration(const char *s)
+{
+  char *end;
+  double d = strtod(s, &end);
+
+  if (end == s || d < 0)
+    return -1;
+  switch (*end) {
+  case 'd': d *= 24;  // fall through
+  case 'h': d *= 60;  // fall through
+  case 'm': d *= 60;  // fall through
+  case 's': end++;
+  }
+  return *end ? -1 : (long long)(d * 1e9);
+}
+
+//
+// do_timeout - timeout builtin: timeout [-k grace] DURATION cmd [args]
+//
+// Runs cmd as an ordinary job (in the background if the line ends in
+// &) and queues a deadline for it. When it passes the job's process
+// group gets SIGTERM, then SIGKILL after the grace period. A
+// foreground job cut short this way returns 124, like timeout(1).
+//
+int do_timeout(char **argv)
+{
+  long long delay, grace = -1;
+  sigset_t mask, prev;
+  pid_t pid;
+  int i = 1;
+
+  if (argv[i] != NULL && !strcmp(argv[i], "-k")) {
+    if (argv[i+1] == NULL || (grace = parseduration(argv[i+1])) < 0) {
+      out_printf("timeout: invalid grace period\n");
+      return 125;
+    }
+    i += 2;
+  }
+  if (argv[i] == NULL || (delay = parseduration(argv[i])) < 0 || argv[i+1] == NULL) {
+    out_printf("Usage: timeout [-k grace] DURATION command [args]\n");
+    return 125;
+  }
+  i++;
+
+  if ((pid = spawn(&argv[i], NULL, 0, curcmd->bg, 0, curcmd->line, NULL)) == 0)
+    return 125;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, &prev);
+  if (delay > 0 && getjobpid(jobs, pid) != NULL)  // a quick one may be gone already
+    timer_add(pid, delay, grace);
+  sigprocmask(SIG_SETMASK, &prev, NULL);
+  if (curcmd->bg)
+    return 0;
+  waitfg(pid);
+  return last_status;  // 124 if the deadline ended it (see jobdone)
+}
+
+//
+// do_jtop - jtop builtin: jtop [-d secs] [-n frames]
+//
+// Refreshes in place until ctrl-c on a terminal; otherwise prints a
+// single frame unless -n says more.
+//
+int do_jtop(char **argv)
+{
+  int interval = 1000, frames = isatty(STDOUT_FILENO) ? 0 : 1;
+
+  for (int i = 1; argv[i] != NULL; i++) {
+    if (!strcmp(argv[i], "-d") && argv[i+1] != NULL)
+      interval = (int)(atof(argv[++i]) * 1000);
+    else if (!strcmp(argv[i], "-n") && argv[i+1] != NULL)
+      frames = atoi(argv[++i]);
+    else {
+      out_printf("Usage: jtop [-d secs] [-n frames]\n");
+      return 2;
+    }
+  }
+  if (interval < 10)
+    interval = 10;
+  return jtop(interval, frames);
+}
+
+//
+// do_metrics - metrics builtin: metrics [-f file]
+//
+// Prints the counters in Prometheus text format; -f starts writing
+// them to file every METRICS_INTERVAL seconds instead.
+//
+int do_metrics(char **argv)
+{
+  char *buf;
+  int len;
+
+  if (argv[1] != NULL) {
+    if (strcmp(argv[1], "-f") != 0 || argv[2] == NULL || argv[3] != NULL) {
+      out_printf("Usage: metrics [-f file]\n");
+      return 2;
+    }
+    metrics_setfile(argv[2]);
+    metrics_tick();
+    return 0;
+  }
+  len = metrics_format(&buf);
+  out_put(buf, len);
+  free(buf);
+  return 0;
+}
+
+//
+// do_after - after builtin: after [-c cap] [-f file] [dep ...] [-- command [args]]
+//
+// Registers command to start in the background once every dep (%jid,
+// pid or @id) has exited with status 0; -f registers a whole DAG file
+// and -c caps how many run at once. With nothing to register it lists
+// the commands still waiting or running.
+//
+int do_after(char **argv)
+{
+  char *deps[DAG_MAXDEPS + 1];
+  int i, n = 0, id, opts = 0;
+
+  for (i = 1; argv[i] != NULL && argv[i][0] == '-' && strcmp(argv[i], "--"); i++, opts++) {
+    if (!strcmp(argv[i], "-c") && argv[i+1] != NULL && atoi(argv[i+1]) > 0)
+      dag_setcap(atoi(argv[++i]));
+    else if (!strcmp(argv[i], "-f") && argv[i+1] != NULL) {
+      if (dag_load(argv[++i]) < 0)
+        return 1;
+    }
+    else {
+      out_printf("Usage: after [-c cap] [-f file] [%%jid|pid|@id ...] [-- command [args]]\n");
+      return 2;
+    }
+  }
+  for (; argv[i] != NULL && strcmp(argv[i], "--"); i++) {
+    if (n == DAG_MAXDEPS) {
+      out_printf("after: too many prerequisites\n");
+      return 2;
+    }
+    deps[n++] = argv[i];
+  }
+  deps[n] = NULL;
+
+  if (argv[i] == NULL) {
+    if (n > 0) {
+      out_printf("after: missing -- command\n");
+      return 2;
+    }
+    if (opts == 0)
+      dag_list();
+    dag_run();
+    return 0;
+  }
+  if ((id = dag_add(deps, &argv[i+1], NULL)) < 0)
+    return 1;
+  out_printf("[@%d] Waiting", id);
+  for (i++; argv[i] != NULL; i++)
+    out_printf(" %s", argv[i]);
+  out_printf("\n");
+  dag_run();
+  return 0;
+}
+
+//
+// do_limit - limit builtin: limit [-r rate] [-b burst] [-m maxjobs]
+//
+// Throttles launches to rate per second (bursts of up to burst, by
+// default one second's worth) and to maxjobs jobs alive at once (a
+// job's own children are not counted);
+// launches over either limit wait rather than fail. 0 lifts a limit.
+// With no options it shows the limits and the throttling counters.
+//
+int do_limit(char **argv)
+{
+  struct limit_stats st;
+  double rate;
+  int burst, max, setrate = 0, setburst = 0;
+
+  limit_get(&rate, &burst, &max);
+  for (int i = 1; argv[i] != NULL; i++) {
+    if (!strcmp(argv[i], "-r") && argv[i+1] != NULL) {
+      rate = atof(argv[++i]);
+      setrate = 1;
+    }
+    else if (!strcmp(argv[i], "-b") && argv[i+1] != NULL) {
+      burst = atoi(argv[++i]);
+      setburst = 1;
+    }
+    else if (!strcmp(argv[i], "-m") && argv[i+1] != NULL)
+      max = atoi(argv[++i]);
+    else {
+      out_printf("Usage: limit [-r rate] [-b burst] [-m maxjobs]\n");
+      return 2;
+    }
+  }
+  if (setrate && !setburst)
+    burst = rate > 1 ? (int)(rate + 0.999) : 1;
+  if (argv[1] != NULL) {
+    limit_set(rate, burst, max);
+    return 0;
+  }
+
+  limit_counters(&st);
+  if (rate > 0)
+    out_printf("rate %g/s, burst %d", rate, burst);
+  else
+    out_printf("rate unlimited");
+  if (max > 0)
+    out_printf(", jobs alive at most %d\n", max);
+  else
+    out_printf(", jobs alive unlimited\n");
+  out_printf("spawns %lu, delayed %lu (%.3f s in all), interrupted %lu, jobs alive %d (peak %d)\n",
+             st.admitted, st.delayed, st.waited / 1e9, st.interrupted, st.live, st.peak);
+  return 0;
+}
 
+//
+// do_batch - batch builtin: batch [-a file] [-l] [-n max] [-P par] command [args]
+//
+// Like xargs: reads items (words, or whole lines with -l) from file or
+// else from the shell's own input, and runs command with as many of
+// them appended as ARG_MAX allows, or at most max. -P runs up to par
+// of those commands at once as background jobs.
+//
+int do_batch(char **argv)
+{
+  struct batch_opts opts = { NULL, 0, 0, 1 };
+  int i, rc;
 
-  return 0;   //must not be a built in command if it makes it to here
+  for (i = 1; argv[i] != NULL && argv[i][0] == '-'; i++) {
+    if (!strcmp(argv[i], "-a") && argv[i+1] != NULL && opts.fp == NULL) {
+      if ((opts.fp = fopen(argv[++i], "r")) == NULL) {
+        out_printf("batch: %s: cannot open\n", argv[i]);
+        return 1;
+      }
+    }
+    else if (!strcmp(argv[i], "-l"))
+      opts.lines = 1;
+    else if (!strcmp(argv[i], "-n") && argv[i+1] != NULL && atoi(argv[i+1]) > 0)
+      opts.maxargs = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-P") && argv[i+1] != NULL && atoi(argv[i+1]) > 0)
+      opts.par = atoi(argv[++i]) < MAXJOBS ? atoi(argv[i]) : MAXJOBS;
+    else
+      break;
+  }
+  if (argv[i] == NULL || argv[i][0] == '-') {
+    out_printf("Usage: batch [-a file] [-l] [-n max] [-P par] command [args]\n");
+    if (opts.fp != NULL)
+      fclose(opts.fp);
+    return 2;
+  }
+  rc = batch_run(&argv[i], &opts);
+  if (opts.fp != NULL)
+    fclose(opts.fp);
+  return rc;
+}
+
+//
+// do_cache - cache builtin:
+//    cache [--inputs file ...] [--env NAME ...] [--mtime] -- command [args]
+//    cache --stats | --clear
+//
+// Replays command's stored stdout, stderr and exit status if it has
+// already run with the same argv, variables and inputs; otherwise runs
+// it in the foreground and stores the result. Inputs are keyed by
+// content, or by size and mtime with --mtime. The output is shown once
+// the command has finished. A job that is stopped or killed by a
+// signal is not stored (and a stopped one loses its later output).
+//
+int do_cache(char **argv)
+{
+  char *inputs[MAXARGS], *vars[MAXARGS], key[MEMO_KEYLEN];
+  int ninputs = 0, nvars = 0, usemtime = 0, i, rc, fds[3];
+  char **list = NULL;
+  int *n = NULL;
+  pid_t pid;
+
+  for (i = 1; argv[i] != NULL && strcmp(argv[i], "--"); i++) {
+    if (!strcmp(argv[i], "--stats") && argv[i+1] == NULL) {
+      memo_stats();
+      return 0;
+    }
+    if (!strcmp(argv[i], "--clear") && argv[i+1] == NULL)
+      return memo_clear() < 0;
+    if (!strcmp(argv[i], "--inputs"))
+      list = inputs, n = &ninputs;
+    else if (!strcmp(argv[i], "--env"))
+      list = vars, n = &nvars;
+    else if (!strcmp(argv[i], "--mtime"))
+      usemtime = 1;
+    else if (list != NULL && strncmp(argv[i], "--", 2) && *n < MAXARGS - 1)
+      list[(*n)++] = argv[i];
+    else
+      break;
+  }
+  if (argv[i] == NULL || strcmp(argv[i], "--") || argv[i+1] == NULL) {
+    out_printf("Usage: cache [--inputs file ...] [--env NAME ...] [--mtime] -- command [args]\n"
+               "       cache --stats | --clear\n");
+    return 2;
+  }
+  argv += i + 1;
+  inputs[ninputs] = vars[nvars] = NULL;
+  if (builtin_lookup(argv[0]) >= 0) {
+    out_printf("cache: %s: cannot cache a builtin\n", argv[0]);
+    return 2;
+  }
+
+  if (memo_key(argv, inputs, vars, usemtime, key) < 0)
+    return 1;
+  if ((rc = memo_replay(key)) >= 0)
+    return rc;
+
+  if (memo_capture(fds) < 0 || (pid = spawn(argv, NULL, 0, 0, 0, curcmd->line, fds)) == 0) {
+    memo_discard(fds);
+    return 1;
+  }
+  waitfg(pid);
+  memo_show(fds);
+  if (getjobpid(jobs, pid) != NULL || last_status >= 128) {
+    memo_discard(fds);            // stopped, or killed: no result to keep
+    return last_status;
+  }
+  rc = last_status;
+  memo_store(key, fds, rc);
+  return rc;
+}
+
+//
+// do_true, do_false - Loop conditions that don't cost a fork
+//
+int do_true(char **argv)
+{
+  return 0;
+}
+
+int do_false(char **argv)
+{
+  return 1;
+}
+
+//
+// do_test - test/[ builtin: string, integer and file tests
+//
+int do_test(char **argv)
+{
+  int argc, neg = 0;
+  struct stat sb;
+
+  for (argc = 1; argv[argc] != NULL; argc++)
+    ;
+  if (argv[0][0] == '[') {
+    if (strcmp(argv[argc-1], "]") != 0) {
+      out_printf("[: missing `]'\n");
+      return 2;
+    }
+    argc--;
+  }
+  argv++, argc--;
+  if (argc > 0 && strcmp(argv[0], "!") == 0)
+    neg = 1, argv++, argc--;
+
+  int r;
+  if (argc == 0)
+    r = 0;
+  else if (argc == 1)
+    r = argv[0][0] != '\0';
+  else if (argc == 2 && !strcmp(argv[0], "-n"))
+    r = argv[1][0] != '\0';
+  else if (argc == 2 && !strcmp(argv[0], "-z"))
+    r = argv[1][0] == '\0';
+  else if (argc == 2 && !strcmp(argv[0], "-e"))
+    r = stat(argv[1], &sb) == 0;
+  else if (argc == 2 && !strcmp(argv[0], "-f"))
+    r = stat(argv[1], &sb) == 0 && S_ISREG(sb.st_mode);
+  else if (argc == 2 && !strcmp(argv[0], "-d"))
+    r = stat(argv[1], &sb) == 0 && S_ISDIR(sb.st_mode);
+  else if (argc == 3 && !strcmp(argv[1], "="))
+    r = strcmp(argv[0], argv[2]) == 0;
+  else if (argc == 3 && !strcmp(argv[1], "!="))
+    r = strcmp(argv[0], argv[2]) != 0;
+  else if (argc == 3 && argv[1][0] == '-') {
+    long a = atol(argv[0]), b = atol(argv[2]);
+    if (!strcmp(argv[1], "-eq")) r = a == b;
+    else if (!strcmp(argv[1], "-ne")) r = a != b;
+    else if (!strcmp(argv[1], "-lt")) r = a < b;
+    else if (!strcmp(argv[1], "-le")) r = a <= b;
+    else if (!strcmp(argv[1], "-gt")) r = a > b;
+    else if (!strcmp(argv[1], "-ge")) r = a >= b;
+    else {
+      out_printf("test: %s: unknown operator\n", argv[1]);
+      return 2;
+    }
+  }
+  else {
+    out_printf("test: too many arguments\n");
+    return 2;
+  }
+  return (r ^ neg) ? 0 : 1;
+}
+
+//
+// setstate - Move a job to state and publish it, with SIGCHLD held
+//    off as sigchld_handler's own changes are
+//
+static void setstate(struct job_t *jobp, int state)
+{
+  sigset_t mask, prev;
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, &prev);
+  jobp->state = state;
+  snap_publish();
+  sigprocmask(SIG_SETMASK, &prev, NULL);
 }
 
 // do_bgfg - Execute the builtin bg and fg commands
 //
-void do_bgfg(char **argv)
+int do_bgfg(char **argv)
 {
   struct job_t *jobp=NULL;
 
   /* Ignore command if no argument */
   if (argv[1] == NULL) {
-    printf("%s command requires PID or %%jobid argument\n", argv[0]);
-    return;
+    out_printf("%s command requires PID or %%jobid argument\n", argv[0]);
+    return 1;
   }
 
   /* Parse the required PID or %JID arg */
   if (isdigit(argv[1][0])) {
     pid_t pid = atoi(argv[1]);
     if (!(jobp = getjobpid(jobs, pid))) {
-      printf("(%d): No such process\n", pid);
-      return;
+      out_printf("(%d): No such process\n", pid);
+      return 1;
     }
   }
 
   else if (argv[1][0] == '%') {
     int jid = atoi(&argv[1][1]);
     if (!(jobp = getjobjid(jobs, jid))) {
-      printf("%s: No such job\n", argv[1]);
-      return;
+      out_printf("%s: No such job\n", argv[1]);
+      return 1;
     }
   }
 
   else {
-    printf("%s: argument must be a PID or %%jobid\n", argv[0]);
-    return;
+    out_printf("%s: argument must be a PID or %%jobid\n", argv[0]);
+    return 1;
 }
 
   //
@@ -258,70 +1213,224 @@ void do_bgfg(char **argv)
   pid = jobp->pid; //get the pid from the jobp pointer
   if (jobp->state == ST){  //if state = stopped
 		if (!strcmp(argv[0], "fg")){ //if first parameter is bg
-				jobp->state = FG;  //chang the state of the process from bg to fg
+				setstate(jobp, FG);  //chang the state of the process from bg to fg
+				term_give(jobp);
 				kill(-pid,SIGCONT); //send a signal to continue
 				waitfg(pid); //wait for fg to terminate before next step
 			}
 		if (!strcmp(argv[0], "bg")){ // if first paramter is fg
-				jobp->state = BG; //change state from fg to bg
-				printf("[%d] (%d) %s", jobp->jid, pid, jobp->cmdline);
+				setstate(jobp, BG); //change state from fg to bg
+				out_safef("[%d] (%d) %s", jobp->jid, pid, jobp->cmdline);
 				kill(-pid, SIGCONT); //send signal to continue
 			}
 		if(jobp->state == BG){
 				if(!strcmp(argv[0], "fg")){ //move any processes in the background to foreground
-						jobp->state = FG;
+						setstate(jobp, FG);
+						term_give(jobp);
 						waitfg(jobp->pid);
 					}
 			}
 	  }
 
-  return;
+  return 0;
 }
 
 
+//
+// waitevent - Sleep until a signal arrives, with SIGCHLD blocked by
+//    the caller and let in again by prev. What we printed goes out
+//    first; the control socket is served and the metrics textfile kept
+//    up to date meanwhile, however long the wait.
+//
+void waitevent(const sigset_t *prev)
+{
+  struct timespec ts;
+  int ms;
+
+  out_flush();
+  metrics_tick();
+  if (ctl_active()) {
+    ctl_poll(-1, metrics_due());
+    return;
+  }
+  if ((ms = metrics_due()) < 0) {
+    sigsuspend(prev);
+    return;
+  }
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = ms % 1000 * 1000000L;
+  ppoll(NULL, 0, &ts, prev);
+}
+
 // waitfg - Block until process pid is no longer the foreground process
 //
+// SIGCHLD is held off between the test and the sleep so that a child
+// event can't slip in between them; waitevent wakes us on the next one.
+//
 void waitfg(pid_t pid)
 {
-	while (fgpid(jobs) == pid){  //stay in infinite loop while process is in fg
-		sleep(1);
-		}
-  return;
+  sigset_t mask, prev;
+
+  if (!vm_pending())
+    input_readahead(READAHEAD);  //parse what comes next while the job runs
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, &prev);
+  while (fgpid(jobs) == pid) { //stay in loop while process is in fg
+    waitevent(&prev);
+    dag_run();  //after-commands keep flowing behind a foreground job
+  }
+  term_take(getjobpid(jobs, pid)); //still listed only if it stopped
+  sigprocmask(SIG_SETMASK, &prev, NULL);
+}
+
+//
+// teardown - End every job before the shell exits. All process groups
+//    are signalled at once, stopped ones continued first so that they
+//    see the SIGTERM; then we sleep on child events until the table is
+//    empty or GRACE_MS passes, SIGKILL whatever is left and reap it.
+//    The time taken is bounded by the grace period, not the job count,
+//    and reported with -v. Only async-signal-safe calls, so
+//    sigquit_handler can use it too.
+//
+static volatile int tearing_down = 0;  // sigchld_handler: no per-job lines
+static sigset_t waitmask;              // everything but SIGCHLD let in
+
+static int livejobs(void)
+{
+  int n = 0;
+
+  for (int i = 0; i < MAXJOBS; i++)
+    n += jobs[i].pid != 0;
+  return n;
+}
+
+static void waitjobs(long long end)
+{
+  struct timespec ts;
+  long long left;
+
+  while (livejobs() > 0 && (left = end - timer_now()) > 0) {
+    ts.tv_sec = left / 1000000000LL;
+    ts.tv_nsec = left % 1000000000LL;
+    ppoll(NULL, 0, &ts, &waitmask);
+  }
+}
+
+void teardown(void)
+{
+  sigset_t mask, prev;
+  long long start = timer_now();
+  int i, njobs, nstopped = 0, nkilled = 0;
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, &prev);
+  waitmask = prev;
+  sigdelset(&waitmask, SIGCHLD);  // even if we came in with it held off
+
+  if ((njobs = livejobs()) == 0) {
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+    return;
+  }
+  tearing_down = 1;
+  for (i = 0; i < MAXJOBS; i++)
+    if (jobs[i].pid != 0 && jobs[i].state == ST) {
+      kill(-jobs[i].pid, SIGCONT);
+      nstopped++;
+    }
+  for (i = 0; i < MAXJOBS; i++)
+    if (jobs[i].pid != 0)
+      kill(-jobs[i].pid, SIGTERM);
+  waitjobs(start + GRACE_MS * 1000000LL);
+
+  for (i = 0; i < MAXJOBS; i++)
+    if (jobs[i].pid != 0) {
+      kill(-jobs[i].pid, SIGKILL);
+      nkilled++;
+    }
+  if (nkilled)
+    waitjobs(timer_now() + GRACE_MS * 1000000LL);  // SIGKILL can't be ignored
+
+  if (verbose)  // tshref says nothing here
+    out_safef("Ended %d jobs (%d stopped, %d killed) in %ld ms\n", njobs, nstopped,
+              nkilled, (long)((timer_now() - start) / 1000000));
+  sigprocmask(SIG_SETMASK, &prev, NULL);
 }
 
 /////////////////////////////////////////////////////////////////////////////
 //
 // Signal handlers
 
-void sigchld_handler(int sig) //sig handler for child
+//
+// jobdone - Take a finished job out of the table; status is its
+//    leader's wait status. Async-signal-safe, for sigchld_handler.
+//
+static void jobdone(pid_t pid, int status, long long start)
 {
-		pid_t pid;
-	int process_state;
-	// Return imediately if no child has exited
-	while ((pid = waitpid(-1, &process_state, WNOHANG|WUNTRACED )) > 0) {   // waitpid function will return a value > 0 which is the PID of the terminated child.
+	struct job_t *jobp = getjobpid(jobs, pid);
+	int fired = timer_fired(pid); // cut short by a deadline (and the mark goes)
 
-	  if (WIFEXITED(process_state)) //used to determine if childrin exit
-	{
-		deletejob(jobs,pid);  // either terminated or stopped
+	if (jobp != NULL && jobp->state == FG) // remember how the foreground job ended
+		last_status = fired ? 124 : statuscode(status);
+	if (WIFEXITED(status))
+		rec_child(pid2jid(pid), 'x', WEXITSTATUS(status));
+	else {
+		rec_child(pid2jid(pid), 'k', WTERMSIG(status));
+		if (!tearing_down) // teardown sums them up instead
+		    out_safef("Job [%d] (%d) terminated by signal %d\n", pid2jid(pid), pid, WTERMSIG(status)); // WTERMSIG returns the number of the signal to term.
 	}
+	recordexit(jobs, pid, status); // keep the status around for wait
+	deletejob(jobs, pid);
+	timer_cancel(pid);  // its pid may go to a new job before the deadline
+	metrics_reaped(WIFSIGNALED(status), timer_now() - start);
+}
 
+void sigchld_handler(int sig) //sig handler for child
+{
+		pid_t pid, pgid;
+	int process_state;
+	long long start = timer_now(); // reap delay is measured from here; the exit time is unknown
+	out_inhandler++; // what we print is not part of a $(...) capture
+	// Return imediately if no child has exited
+	while ((pid = reaper_next(&process_state, &pgid)) > 0) {   // the PID of a child that exited or stopped
 
-	if (WIFSIGNALED(process_state)) {			//WIFSIGNALED: True if child terminated by signal
-		printf("Job [%d] (%d) terminated by signal %d\n", pid2jid(pid), pid, WTERMSIG(process_state)); // WTERMSIG returns the number of the signal to term.
-	    deletejob(jobs,pid);					// child process to terminate
-
-	   }
+	struct job_t *jobp = getjobpid(jobs, pid);
 
+	if (jobp == NULL && pgid != pid && reaper_on) { // a job's orphaned descendant (tsh -r)
+		if (!WIFSTOPPED(process_state))
+			metrics_orphaned();
+		continue; // its job is looked at below
+	}
 
 	if (WIFSTOPPED(process_state)) // if a process stops, display it
 	{
-		getjobpid(jobs,pid)->state = ST;
-		printf("Job [%d] (%d) stopped by signal %d\n", pid2jid(pid),pid,WSTOPSIG(process_state));// WSTOPSIG returns the number of the signal that caused the child process to stop
+		rec_child(pid2jid(pid), 'z', WSTOPSIG(process_state));
+		if (jobp != NULL)
+			jobp->state = ST;
+		snap_publish();
+		metrics_stopped();
+		out_safef("Job [%d] (%d) stopped by signal %d\n", pid2jid(pid),pid,WSTOPSIG(process_state));// WSTOPSIG returns the number of the signal that caused the child process to stop
+		continue;
+	}
 
+	limit_reaped();
+	if (reaper_on && jobp != NULL && !reaper_groupgone(pid)) { // the leader is gone but not its group
+		jobp->leftover = 1;
+		jobp->status = process_state;
+		continue;
 	}
+	jobdone(pid, process_state, start); // exited or terminated
 }
 
+	// A job whose leader went first ends with the last of its group,
+	// whether or not that was one of ours to reap
+	for (int i = 0; reaper_on && i < MAXJOBS; i++)
+		if (jobs[i].pid != 0 && jobs[i].leftover && reaper_groupgone(jobs[i].pid))
+			jobdone(jobs[i].pid, jobs[i].status, start);
 
+	out_inhandler--;
 	return;
 }
 
@@ -335,9 +1444,13 @@ void sigint_handler(int sig)
 {
 	pid_t pid = fgpid(jobs);
 
+	rec_signal(sig);
+
 	if(pid != 0){
 		kill(-pid, SIGINT);
 	} //interrupt all the processes in the process group
+	else
+		vm_interrupt = 1; // no job to forward to: break out of a running loop
   return;
 }
 
@@ -351,6 +1464,8 @@ void sigtstp_handler(int sig)
 {
 	pid_t pid = fgpid(jobs);
 
+	rec_signal(sig);
+
 	if (pid != 0)	//if the pid of the foreground process is different that zero
 		kill(-pid, SIGTSTP); //stp all the processes in the process group
   return;
@@ -0,0 +1,31 @@
+/*
+ * tshbuiltin.h - The C interface for loadable tsh builtins
+ *
+ * A loadable builtin is a shared object that exports, for each builtin
+ * NAME it provides, a variable
+ *
+ *     struct tsh_builtin NAME_builtin = {
+ *         TSH_BUILTIN_ABI, "NAME", NAME_main, "NAME [args]"
+ *     };
+ *
+ * and is loaded into a running shell with "enable -f lib.so NAME".
+ * The function runs in the shell process, with the shell's stdin,
+ * stdout and stderr, and returns the command's exit status. It must
+ * not exit, and must leave signal dispositions and the signal mask as
+ * it found them.
+ *
+ * Build with: cc -fPIC -shared -o lib.so lib.c
+ */
+#ifndef _tshbuiltin_h_
+#define _tshbuiltin_h_
+
+#define TSH_BUILTIN_ABI 1
+
+struct tsh_builtin {
+    int abi;                            /* TSH_BUILTIN_ABI */
+    const char *name;                   /* the command name */
+    int (*fn)(int argc, char **argv);   /* argv[0] is the name */
+    const char *usage;                  /* one line for "enable" */
+};
+
+#endif
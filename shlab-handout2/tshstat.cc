@@ -0,0 +1,130 @@
+/*
+ * tshstat.c - Show what running shells are doing, without asking them
+ *
+ * usage: tshstat [<pid> ...]
+ * Prints the job table of each shell started with tsh -j (all of them
+ * if no pids are given), read from its shared-memory snapshot. The
+ * segment is mapped read-only and the shell is never signalled or
+ * woken, so this is safe to run as often as a monitor likes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <glob.h>
+#include <signal.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snap.h"
+
+#define SNAP_TRIES 4096  /* read attempts before a snapshot is called stale */
+
+/*
+ * read_snap - Copy a consistent snapshot out of the seqlock into copy
+ *    and its sequence number into *seq. Returns 0, or -1 if the shell
+ *    died mid-update or kept writing for SNAP_TRIES attempts; the copy
+ *    is then a best effort and may be torn.
+ */
+static int read_snap(const struct snap_t *shared, struct snap_t *copy, int pid, unsigned *seq)
+{
+    unsigned s1, s2;
+    int tries;
+
+    for (tries = 1; tries <= SNAP_TRIES; tries++) {
+	s1 = __atomic_load_n(&shared->seq, __ATOMIC_ACQUIRE);
+	if (!(s1 & 1)) {
+	    memcpy(copy, shared, sizeof(*copy));
+	    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+	    s2 = __atomic_load_n(&shared->seq, __ATOMIC_RELAXED);
+	    if (s1 == s2) {
+		*seq = s1;
+		return 0;
+	    }
+	}
+	if (tries % 64 == 0) {      /* the writer may have been preempted, or be gone */
+	    if (kill(pid, 0) < 0 && errno == ESRCH)
+		break;
+	    sched_yield();
+	}
+    }
+    memcpy(copy, shared, sizeof(*copy));
+    *seq = __atomic_load_n(&shared->seq, __ATOMIC_RELAXED);
+    return -1;
+}
+
+/* show - Print the job table of the shell with the given pid */
+static int show(int pid)
+{
+    static const char *states[] = { "Undefined", "Foreground", "Running", "Stopped" };
+    struct snap_t *shared, snap;
+    struct stat sb;
+    struct timespec ts;
+    char name[32];
+    long long now, secs;
+    unsigned seq;
+    int fd, i, n, stale;
+
+    snprintf(name, sizeof(name), SNAP_PREFIX "%d", pid);
+    if ((fd = shm_open(name, O_RDONLY, 0)) < 0) {
+	fprintf(stderr, "tshstat: %d: %s\n", pid, strerror(errno));
+	return 1;
+    }
+    if (fstat(fd, &sb) < 0 || sb.st_size < (off_t)sizeof(struct snap_t) ||
+	(shared = (struct snap_t *)mmap(NULL, sizeof(struct snap_t), PROT_READ,
+					MAP_SHARED, fd, 0)) == MAP_FAILED) {
+	fprintf(stderr, "tshstat: %d: not a job table snapshot\n", pid);
+	close(fd);
+	return 1;
+    }
+    close(fd);
+    if (__atomic_load_n(&shared->magic, __ATOMIC_ACQUIRE) != SNAP_MAGIC ||
+	shared->version != SNAP_VERSION) {
+	fprintf(stderr, "tshstat: %d: not a version %d snapshot\n", pid, SNAP_VERSION);
+	munmap(shared, sizeof(struct snap_t));
+	return 1;
+    }
+    stale = read_snap(shared, &snap, pid, &seq) < 0;
+    munmap(shared, sizeof(struct snap_t));
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    now = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    for (n = 0, i = 0; i < SNAP_MAXJOBS; i++)
+	n += snap.jobs[i].pid != 0;
+    printf("tsh %d: %d job%s, change %u%s%s\n", snap.shell, n, n == 1 ? "" : "s", seq / 2,
+	   kill(snap.shell, 0) < 0 && errno == ESRCH ? " (shell is gone)" : "",
+	   stale ? " (stale: caught mid-update)" : "");
+    for (i = 0; i < SNAP_MAXJOBS; i++) {
+	if (snap.jobs[i].pid == 0)
+	    continue;
+	secs = (now - snap.jobs[i].start) / 1000000000LL;
+	printf("[%d] (%d) %-10s %3lld:%02lld:%02lld %s\n", snap.jobs[i].jid, snap.jobs[i].pid,
+	       states[snap.jobs[i].state & 3], secs / 3600, secs / 60 % 60, secs % 60,
+	       snap.jobs[i].cmdline);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    glob_t g;
+    size_t i;
+    int rc = 0;
+
+    if (argc > 1) {
+	for (i = 1; i < (size_t)argc; i++)
+	    rc |= show(atoi(argv[i]));
+	exit(rc);
+    }
+    if (glob("/dev/shm" SNAP_PREFIX "*", 0, NULL, &g) != 0) {
+	printf("tshstat: no shells are publishing their jobs (tsh -j)\n");
+	exit(0);
+    }
+    for (i = 0; i < g.gl_pathc; i++)
+	rc |= show(atoi(strrchr(g.gl_pathv[i], '.') + 1));
+    globfree(&g);
+    exit(rc);
+}
@@ -0,0 +1,570 @@
+#include "vm.h"
+#include "globals.h"
+#include "expand.h"
+#include "env.h"
+#include "helper-routines.h"
+#include "output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**********************************************
+ * Control-flow compiler and bytecode VM
+ **********************************************/
+
+volatile sig_atomic_t vm_interrupt = 0;
+
+/* Tokens */
+#define T_EOF   0
+#define T_WORD  1
+#define T_SEMI  2   /* ; */
+#define T_NL    3   /* newline */
+#define T_AND   4   /* && */
+#define T_OR    5   /* || */
+#define T_AMP   6   /* & */
+
+struct comp_t {             /* compiler state */
+    const char *src;        /* program text */
+    int pos;                /* lexer position */
+    int tok;                /* current token */
+    int start, end;         /* extent of the current token in src */
+    int status;             /* VM_OK, VM_INCOMPLETE or VM_ERROR */
+    struct prog_t *prog;
+};
+
+/*
+ * Lexer
+ */
+
+/* isbreak - Does c end a word? */
+static int isbreak(const char *s)
+{
+    return *s == '\0' || *s == ' ' || *s == '\t' || *s == '\n' ||
+	*s == ';' || *s == '&' || (s[0] == '|' && s[1] == '|');
+}
+
+/* next - Advance to the next token */
+static void next(struct comp_t *c)
+{
+    const char *s = c->src;
+    int p = c->pos, depth;
+
+    while (s[p] == ' ' || s[p] == '\t')
+	p++;
+    if (s[p] == '#')                    /* comment runs to end of line */
+	while (s[p] && s[p] != '\n')
+	    p++;
+    c->start = p;
+
+    if (s[p] == '\0')
+	c->tok = T_EOF;
+    else if (s[p] == '\n')
+	c->tok = T_NL, p++;
+    else if (s[p] == ';')
+	c->tok = T_SEMI, p++;
+    else if (s[p] == '&' && s[p+1] == '&')
+	c->tok = T_AND, p += 2;
+    else if (s[p] == '&')
+	c->tok = T_AMP, p++;
+    else if (s[p] == '|' && s[p+1] == '|')
+	c->tok = T_OR, p += 2;
+    else {
+	c->tok = T_WORD;
+	while (!isbreak(s + p)) {
+	    if (s[p] == '\'') {                 /* quoted: up to the close */
+		const char *q = strchr(s + p + 1, '\'');
+		if (q == NULL) {
+		    c->status = VM_INCOMPLETE;
+		    c->tok = T_EOF;
+		    return;
+		}
+		p = q - s + 1;
+	    }
+	    else if (s[p] == '$' && s[p+1] == '(') { /* $( ... ) nests */
+		for (depth = 0, p++; s[p]; p++) {
+		    if (s[p] == '(')
+			depth++;
+		    else if (s[p] == ')' && --depth == 0)
+			break;
+		}
+		if (s[p] == '\0') {
+		    c->status = VM_INCOMPLETE;
+		    c->tok = T_EOF;
+		    return;
+		}
+		p++;
+	    }
+	    else if (s[p] == '`') {
+		const char *q = strchr(s + p + 1, '`');
+		if (q == NULL) {
+		    c->status = VM_INCOMPLETE;
+		    c->tok = T_EOF;
+		    return;
+		}
+		p = q - s + 1;
+	    }
+	    else
+		p++;
+	}
+    }
+    c->end = p;
+    c->pos = p;
+}
+
+/* isword - Is the current token the (unquoted) word w? */
+static int isword(struct comp_t *c, const char *w)
+{
+    int n = strlen(w);
+
+    return c->tok == T_WORD && c->end - c->start == n &&
+	strncmp(c->src + c->start, w, n) == 0;
+}
+
+/* iskeyword - Does the current token end a list? */
+static int iskeyword(struct comp_t *c)
+{
+    return isword(c, "do") || isword(c, "done") || isword(c, "then") ||
+	isword(c, "elif") || isword(c, "else") || isword(c, "fi");
+}
+
+/* fail - Record a syntax error (or running out of input) */
+static void fail(struct comp_t *c)
+{
+    if (c->status != VM_OK)
+	return;
+    if (c->tok == T_EOF)
+	c->status = VM_INCOMPLETE;
+    else {
+	c->status = VM_ERROR;
+	if (c->tok == T_NL)
+	    out_printf("tsh: syntax error near `newline'\n");
+	else
+	    out_printf("tsh: syntax error near `%.*s'\n", c->end - c->start, c->src + c->start);
+    }
+}
+
+/* expect - Consume keyword w or fail */
+static int expect(struct comp_t *c, const char *w)
+{
+    if (!isword(c, w)) {
+	fail(c);
+	return 0;
+    }
+    next(c);
+    return 1;
+}
+
+/* skipnl - Skip newlines */
+static void skipnl(struct comp_t *c)
+{
+    while (c->tok == T_NL)
+	next(c);
+}
+
+/*
+ * Code generation
+ */
+
+static int emit(struct prog_t *p, int op, int a, int b, int cc)
+{
+    if (p->ncode == p->capcode) {
+	p->capcode = p->capcode ? 2 * p->capcode : 32;
+	p->code = (struct insn_t *)realloc(p->code, p->capcode * sizeof(struct insn_t));
+	if (p->code == NULL)
+	    unix_error("vm: realloc error");
+    }
+    p->code[p->ncode].op = op;
+    p->code[p->ncode].a = a;
+    p->code[p->ncode].b = b;
+    p->code[p->ncode].c = cc;
+    return p->ncode++;
+}
+
+/* addstr - Intern n bytes of s (plus suffix) as a program string */
+static int addstr(struct prog_t *p, const char *s, int n, const char *suffix)
+{
+    char *str;
+
+    if (p->nstrs == p->capstrs) {
+	p->capstrs = p->capstrs ? 2 * p->capstrs : 16;
+	p->strs = (char **)realloc(p->strs, p->capstrs * sizeof(char *));
+	if (p->strs == NULL)
+	    unix_error("vm: realloc error");
+    }
+    if ((str = (char *)malloc(n + strlen(suffix) + 1)) == NULL)
+	unix_error("vm: malloc error");
+    memcpy(str, s, n);
+    strcpy(str + n, suffix);
+    p->strs[p->nstrs] = str;
+    return p->nstrs++;
+}
+
+/*
+ * Parser: a recursive descent over
+ *   list    := andor ((';' | '&' | newline) andor)*
+ *   andor   := command (('&&' | '||') newline* command)*
+ *   command := simple | for | while | until | if
+ */
+static void list(struct comp_t *c);
+static void command(struct comp_t *c);
+
+static void simple(struct comp_t *c)
+{
+    int start = c->start, end = c->end;
+
+    while (c->tok == T_WORD) {
+	end = c->end;
+	next(c);
+    }
+    if (c->tok == T_AMP) {
+	emit(c->prog, OP_CMD, addstr(c->prog, c->src + start, end - start, " &\n"), 0, 0);
+	next(c);
+    }
+    else
+	emit(c->prog, OP_CMD, addstr(c->prog, c->src + start, end - start, "\n"), 0, 0);
+}
+
+/* for NAME in WORDS ; do LIST done */
+static void forloop(struct comp_t *c)
+{
+    struct prog_t *p = c->prog;
+    int slot = p->nslots++, name, words, top, jend, start, end;
+
+    next(c);
+    if (c->tok != T_WORD) {
+	fail(c);
+	return;
+    }
+    name = addstr(p, c->src + c->start, c->end - c->start, "");
+    next(c);
+    if (!expect(c, "in"))
+	return;
+    start = end = c->start;
+    while (c->tok == T_WORD) {
+	end = c->end;
+	next(c);
+    }
+    words = addstr(p, c->src + start, end - start, "");
+    if (c->tok != T_SEMI && c->tok != T_NL) {
+	fail(c);
+	return;
+    }
+    next(c);
+    skipnl(c);
+    if (!expect(c, "do"))
+	return;
+
+    emit(p, OP_FORINIT, slot, words, 0);
+    top = emit(p, OP_FORNEXT, slot, 0, name);
+    list(c);
+    emit(p, OP_JMP, top, 0, 0);
+    jend = p->ncode;
+    p->code[top].b = jend;
+    expect(c, "done");
+}
+
+/* while LIST ; do LIST done (until negates the test) */
+static void whileloop(struct comp_t *c)
+{
+    struct prog_t *p = c->prog;
+    int jop = isword(c, "until") ? OP_JZ : OP_JNZ;
+    int top = p->ncode, jexit;
+
+    next(c);
+    list(c);
+    jexit = emit(p, jop, 0, 0, 0);
+    if (!expect(c, "do"))
+	return;
+    list(c);
+    emit(p, OP_JMP, top, 0, 0);
+    p->code[jexit].a = emit(p, OP_TRUE, 0, 0, 0);
+    expect(c, "done");
+}
+
+/*
+ * if LIST ; then LIST [elif LIST ; then LIST]... [else LIST] fi
+ *    The jumps to fi are chained through their own targets until fi's
+ *    address is known, so any number of elifs fit.
+ */
+static void ifstmt(struct comp_t *c)
+{
+    struct prog_t *p = c->prog;
+    int jnext, jfi = -1, j;
+
+    do {
+	next(c);                        /* if or elif */
+	list(c);
+	jnext = emit(p, OP_JNZ, 0, 0, 0);
+	if (!expect(c, "then"))
+	    return;
+	list(c);
+	jfi = emit(p, OP_JMP, jfi, 0, 0);
+	p->code[jnext].a = p->ncode;
+    } while (c->status == VM_OK && isword(c, "elif"));
+
+    if (isword(c, "else")) {
+	next(c);
+	list(c);
+    }
+    else
+	emit(p, OP_TRUE, 0, 0, 0);
+    for (; jfi >= 0; jfi = j) {
+	j = p->code[jfi].a;
+	p->code[jfi].a = p->ncode;
+    }
+    expect(c, "fi");
+}
+
+static void command(struct comp_t *c)
+{
+    if (c->tok != T_WORD || iskeyword(c))
+	fail(c);
+    else if (isword(c, "for"))
+	forloop(c);
+    else if (isword(c, "while") || isword(c, "until"))
+	whileloop(c);
+    else if (isword(c, "if"))
+	ifstmt(c);
+    else
+	simple(c);
+}
+
+static void andor(struct comp_t *c)
+{
+    struct prog_t *p = c->prog;
+    int j;
+
+    command(c);
+    while (c->status == VM_OK && (c->tok == T_AND || c->tok == T_OR)) {
+	j = emit(p, c->tok == T_AND ? OP_JNZ : OP_JZ, 0, 0, 0);
+	next(c);
+	skipnl(c);
+	command(c);
+	p->code[j].a = p->ncode;
+    }
+}
+
+static void list(struct comp_t *c)
+{
+    int n = 0;
+
+    for (;;) {
+	while (c->tok == T_NL || c->tok == T_SEMI)
+	    next(c);
+	if (c->status != VM_OK || c->tok == T_EOF || iskeyword(c))
+	    break;
+	andor(c);
+	n++;
+    }
+    if (n == 0 && c->status == VM_OK)
+	fail(c);
+}
+
+/*
+ * vm_compile - Compile src into prog. Returns VM_OK, VM_INCOMPLETE
+ *    when src stops in the middle of a construct, or VM_ERROR.
+ */
+int vm_compile(const char *src, struct prog_t *prog)
+{
+    struct comp_t c;
+
+    memset(prog, 0, sizeof(*prog));
+    c.src = src;
+    c.pos = 0;
+    c.status = VM_OK;
+    c.prog = prog;
+    next(&c);
+    list(&c);
+    if (c.status == VM_OK && c.tok != T_EOF)
+	fail(&c);
+    if (c.status != VM_OK)
+	vm_free(prog);
+    return c.status;
+}
+
+/* vm_free - Release a compiled program */
+void vm_free(struct prog_t *prog)
+{
+    int i;
+
+    for (i = 0; i < prog->nstrs; i++)
+	free(prog->strs[i]);
+    free(prog->strs);
+    free(prog->code);
+    memset(prog, 0, sizeof(*prog));
+}
+
+/*
+ * The VM
+ */
+
+struct slot_t {             /* state of one for loop */
+    char *buf;              /* expanded word list, split in place */
+    int cap;                /* bytes in buf */
+    char **words;           /* the words, pointing into buf */
+    int n, i, wcap;
+};
+
+/* forinit - Expand and split the word list of a for loop, of any length */
+static void forinit(struct slot_t *s, char *text)
+{
+    char *w;
+    int len;
+
+    if ((w = expand_alloc(text, &s->buf, &s->cap)) != s->buf) {  /* nothing expanded */
+	len = strlen(w);
+	if (len + 1 > s->cap) {
+	    s->cap = len + 1;
+	    if ((s->buf = (char *)realloc(s->buf, s->cap)) == NULL)
+		unix_error("vm: realloc error");
+	}
+	memcpy(s->buf, w, len + 1);
+    }
+    s->n = s->i = 0;
+    for (w = strtok(s->buf, " \t\n"); w; w = strtok(NULL, " \t\n")) {
+	if (s->n == s->wcap) {
+	    s->wcap = s->wcap ? 2 * s->wcap : 64;
+	    if ((s->words = (char **)realloc(s->words, s->wcap * sizeof(char *))) == NULL)
+		unix_error("vm: realloc error");
+	}
+	s->words[s->n++] = w;
+    }
+}
+
+/*
+ * vm_exec - Run a compiled program. Returns 0, or -1 if it was cut
+ *    short by ctrl-c.
+ */
+int vm_exec(struct prog_t *p)
+{
+    struct slot_t *slots = NULL;
+    struct insn_t *in;
+    int pc = 0, rc = 0;
+
+    if (p->nslots > 0 &&
+	(slots = (struct slot_t *)calloc(p->nslots, sizeof(struct slot_t))) == NULL)
+	unix_error("vm: calloc error");
+
+    vm_interrupt = 0;
+    while (pc < p->ncode) {
+	if (vm_interrupt) {
+	    rc = -1;
+	    break;
+	}
+	in = &p->code[pc++];
+	switch (in->op) {
+	case OP_CMD:
+	    eval(p->strs[in->a]);
+	    if (last_status == 128 + SIGINT)
+		vm_interrupt = 1;
+	    break;
+	case OP_JMP:
+	    pc = in->a;
+	    break;
+	case OP_JZ:
+	    if (last_status == 0)
+		pc = in->a;
+	    break;
+	case OP_JNZ:
+	    if (last_status != 0)
+		pc = in->a;
+	    break;
+	case OP_FORINIT:
+	    forinit(&slots[in->a], p->strs[in->b]);
+	    last_status = 0;
+	    break;
+	case OP_FORNEXT:
+	    if (slots[in->a].i < slots[in->a].n)
+		env_set(p->strs[in->c], slots[in->a].words[slots[in->a].i++]);
+	    else
+		pc = in->b;
+	    break;
+	case OP_TRUE:
+	    last_status = 0;
+	    break;
+	}
+    }
+    for (int i = 0; i < p->nslots; i++) {
+	free(slots[i].buf);
+	free(slots[i].words);
+    }
+    free(slots);
+    return rc;
+}
+
+/*
+ * Feeding the VM from the read loop
+ */
+
+static char *block = NULL;      /* pending multi-line construct */
+static int blocklen = 0, blockcap = 0;
+
+/* vm_iscontrol - Does line start a construct the VM must handle? */
+int vm_iscontrol(const char *line)
+{
+    const char *s = line, *e;
+    int n, quoted = 0;
+
+    while (*s == ' ' || *s == '\t')
+	s++;
+    for (e = s; *e && !isbreak(e); e++)
+	;
+    n = e - s;
+    if ((n == 3 && !strncmp(s, "for", 3)) || (n == 5 && !strncmp(s, "while", 5)) ||
+	(n == 5 && !strncmp(s, "until", 5)) || (n == 2 && !strncmp(s, "if", 2)))
+	return 1;
+    for (; *s; s++) {
+	if (*s == '\'')
+	    quoted = !quoted;
+	else if (!quoted && (s[0] == ';' || (s[0] == '&' && s[1] == '&') ||
+			     (s[0] == '|' && s[1] == '|')))
+	    return 1;
+    }
+    return 0;
+}
+
+/* vm_pending - Is a construct waiting for more lines? */
+int vm_pending(void)
+{
+    return blocklen > 0;
+}
+
+/*
+ * vm_feed - Offer a line read by the shell to the VM. Returns 0 if
+ *    the line is a plain command the caller should eval() itself,
+ *    otherwise 1: the line was buffered, or completed a construct
+ *    that has now been compiled and run.
+ */
+int vm_feed(char *line)
+{
+    struct prog_t prog;
+    int n = strlen(line);
+
+    if (blocklen == 0 && !vm_iscontrol(line))
+	return 0;
+
+    if (blocklen + n + 1 > blockcap) {
+	blockcap = 2 * (blocklen + n + 1);
+	if ((block = (char *)realloc(block, blockcap)) == NULL)
+	    unix_error("vm: realloc error");
+    }
+    memcpy(block + blocklen, line, n + 1);
+    blocklen += n;
+
+    switch (vm_compile(block, &prog)) {
+    case VM_INCOMPLETE:
+	return 1;
+    case VM_OK:
+	blocklen = 0;
+	vm_exec(&prog);
+	vm_free(&prog);
+	return 1;
+    default:
+	blocklen = 0;
+	last_status = 2;
+	return 1;
+    }
+}
+/**********************************
+ * end control-flow compiler and VM
+ **********************************/
@@ -0,0 +1,53 @@
+//-*-c++-*-
+#ifndef _vm_h_
+#define _vm_h_
+
+#include <signal.h>
+
+/*
+ * Control flow (for/while/until/if and ; / && / || lists) is compiled
+ * once into bytecode and run by a small VM. Simple commands inside a
+ * program still go through eval(), so builtins never fork, and each
+ * is expanded only when its turn comes, so $? sees the one before.
+ */
+
+/* Bytecode operations */
+#define OP_CMD      1   /* eval command text a */
+#define OP_JMP      2   /* jump to a */
+#define OP_JZ       3   /* jump to a if the last status is zero */
+#define OP_JNZ      4   /* jump to a if the last status is nonzero */
+#define OP_FORINIT  5   /* expand word list b into loop slot a */
+#define OP_FORNEXT  6   /* set variable c to the next word of slot a, else jump to b */
+#define OP_TRUE     7   /* set the last status to zero */
+
+/* Results of vm_compile */
+#define VM_OK          0
+#define VM_INCOMPLETE  1   /* more input lines are needed */
+#define VM_ERROR       2   /* syntax error */
+
+struct insn_t {
+    int op;
+    int a, b, c;
+};
+
+struct prog_t {
+    struct insn_t *code;    /* instructions */
+    int ncode, capcode;
+    char **strs;            /* command texts, word lists and names */
+    int nstrs, capstrs;
+    int nslots;             /* for-loop slots */
+};
+
+int vm_compile(const char *src, struct prog_t *prog);
+int vm_exec(struct prog_t *prog);
+void vm_free(struct prog_t *prog);
+
+int vm_feed(char *line);
+int vm_iscontrol(const char *line);
+int vm_pending(void);
+
+extern volatile sig_atomic_t vm_interrupt;  /* ctrl-c with no foreground job */
+
+void eval(char *cmdline);  // defined in tsh.cc
+
+#endif